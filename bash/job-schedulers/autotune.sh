@@ -0,0 +1,368 @@
+#!/bin/bash
+
+#
+# A script to find the fastest MPI x OMP decomposition and OpenMP affinity
+# settings of a command under different job-schedulers.
+#
+# Supported job-schedulers: Local, SLURM and PJM.
+#
+# Given a core budget and a number of nodes, every MPI x OMP decomposition of
+# the cores of a node is combined with every OMP_PROC_BIND and OMP_PLACES value.
+# Instead of running the full grid several times, the configurations are
+# explored using successive halving: every round runs the surviving
+# configurations, configurations that are clearly losing are discarded, and only
+# the best 1/eta of the remaining configurations advance to the next round,
+# which runs each of them eta times more.
+#
+# Before executing this script you have to define this variables:
+#
+#    Clean the stage folder of the jobs after finishing? 1 -> yes, 0 -> no.
+#    clean=1
+#
+#    The name of the job.
+#    job="NAME-OF-THE-JOB"
+#
+#    Command to tune.
+#    You can access the number of mpi-ranks using the environment variable
+#    MPI_RANKS and the number of omp-threads using the environment variable
+#    OMP_NUM_THREADS:
+#    command='command $MPI_RANKS $OMP_NUM_THREADS'
+#
+#    Additional arguments to pass to the command.
+#    command_opts="-s 1"
+#
+#    Number of nodes and number of cores of each node to use.
+#    nodes=1
+#    cores=48
+#
+# Optional variables:
+#
+#    OMP_PROC_BIND and OMP_PLACES values to explore. An empty value leaves the
+#    variable unset.
+#    proc_binds=('close' 'spread')
+#    omp_places=('cores' 'threads')
+#
+#    Fraction of configurations that advance to the next round (1/eta) and
+#    growth factor of the number of runs of each configuration per round.
+#    eta=2
+#
+#    Number of runs of each configuration in the first round.
+#    reps=1
+#
+#    Configurations whose metric is worse than cutoff times the best metric of
+#    the round are discarded immediately.
+#    cutoff=1.5
+#
+#    By default, the lower the metric the better (e.g. time). Set maximize to 1
+#    if the higher the metric the better (e.g. GFLOP/s).
+#    maximize=0
+#
+#    Maximum allowed execution time of each run.
+#    time="hh:mm:ss"
+#
+#    Run the command in exclusive mode.
+#    exclusive=1
+#
+#    Scheduler additional parameters.
+#    job_options=(
+#        '--qos=debug'
+#    )
+#
+# You also have to define this two functions:
+#
+#    This function is executed before launching a job. You can use this function to
+#    prepare the stage folder of the job.
+#
+#    before_run() (
+#        job_name="$1"
+#    )
+#
+#    This function is executed when a job has finished. You can use this function to
+#    perform a sanity check and to extract the metric of the run.
+#
+#    echo: The metric of the run in the last line.
+#    return: 0 if the run is correct, 1 otherwise.
+#
+#    after_run() (
+#        job_name="$1"
+#
+#        echo "12.5"
+#        return 1 # Failure
+#        return 0 # OK
+#    )
+#
+# WARNING: ALWAYS CALL THIS SCRIPT USING SOURCE AS YOU CAN NOT EXPORT ARRAYS
+# IN BASH.
+#
+#    source "autotune.sh"
+#
+
+################################################################################
+
+source "$(dirname "${BASH_SOURCE[0]}")/jobs.sh"
+
+# Trap ctrl_c -> Cancel the jobs.
+ctrl_c_trap() (
+    for job_id in "${jobs_id[@]}"; do
+        cancel_job "$job_id"
+    done
+)
+
+# Trap ctrl_c -> Cancel the jobs.
+trap ctrl_c_trap EXIT
+
+#
+# Default values.
+#
+
+if [[ -z "$nodes" || "$nodes" -lt 1 ]]; then
+    nodes=1
+fi
+if [[ -z "$cores" || "$cores" -lt 1 ]]; then
+    echo -e "\033[31mError: The core budget (cores) is not defined\e[0m"
+    return 1
+fi
+if [[ ${#proc_binds[@]} -eq 0 ]]; then
+    proc_binds=('close' 'spread')
+fi
+if [[ ${#omp_places[@]} -eq 0 ]]; then
+    omp_places=('cores' 'threads')
+fi
+eta="${eta:-2}"
+reps="${reps:-1}"
+cutoff="${cutoff:-1.5}"
+maximize="${maximize:-0}"
+
+#
+# Build the search space.
+#
+
+configs=()
+for ((ranks_per_node = 1; ranks_per_node <= cores; ++ranks_per_node)); do
+    if [[ $((cores % ranks_per_node)) -ne 0 ]]; then
+        continue
+    fi
+
+    mpi=$((ranks_per_node * nodes))
+    omp=$((cores / ranks_per_node))
+
+    if [[ $omp -eq 1 ]]; then
+        # The affinity of a single thread per rank is decided by the MPI launcher.
+        configs+=("nodes=$nodes, mpi=$mpi, omp=$omp")
+        continue
+    fi
+
+    for bind in "${proc_binds[@]}"; do
+        for places in "${omp_places[@]}"; do
+            config="nodes=$nodes, mpi=$mpi, omp=$omp"
+            if [[ -n "$bind" ]]; then
+                config+=", bind=$bind"
+            fi
+            if [[ -n "$places" ]]; then
+                config+=", places=$places"
+            fi
+            configs+=("$config")
+        done
+    done
+done
+
+scriptpath="$(realpath $0)"
+workfolder="$(pwd)"
+
+echo "[Setup]"
+echo "    job scheduler:     '$job_scheduler'"
+echo "    working directory: '$workfolder'"
+echo "    script path:       '$scriptpath'"
+echo "    nodes:             $nodes"
+echo "    cores per node:    $cores"
+echo "    eta:               $eta"
+echo "    cutoff:            $cutoff"
+echo ""
+echo "[==========] Exploring ${#configs[@]} configuration(s)"
+echo "[==========] Started on $(date)"
+echo ""
+
+# Sum and number of the metrics of every configuration.
+metric_sum=()
+metric_count=()
+for c in "${!configs[@]}"; do
+    metric_sum[$c]=0
+    metric_count[$c]=0
+done
+
+survivors=("${!configs[@]}")
+valid_jobs=()
+nruns=0
+round=0
+round_reps="$reps"
+
+while :; do
+    echo "==================== Round $round: ${#survivors[@]} configuration(s), $round_reps run(s) each ===================="
+    echo ""
+
+    #
+    # Starting the jobs of the round.
+    #
+
+    jobs_id=()
+    jobs_name=()
+    jobs_config=()
+    failed_configs=()
+    for c in "${survivors[@]}"; do
+        par="${configs[c]}"
+
+        nodes_c="$(parallelism_value "$par" nodes)"
+        mpi="$(parallelism_value "$par" mpi)"
+        omp="$(parallelism_value "$par" omp)"
+        bind="$(parallelism_value "$par" bind)"
+        places="$(parallelism_value "$par" places)"
+
+        for ((rep = 0; rep < round_reps; ++rep)); do
+            date_compact="$(date '+%Y%m%d_%H%M%S')"
+            job_name="${job}_autotune_round_${round}_config_${c}_rep_${rep}_${date_compact}"
+            job_id="-1"
+
+            mkdir "$job_name" >/dev/null 2>&1
+
+            # Create the job script
+            jobscript="$(create_jobscript "$job_name" "$nodes_c" "$mpi" "$omp" "$command" "$bind" "$places")"
+
+            # cd to the stage folder of the job.
+            current_folder="$(pwd)"
+            cd "$job_name"
+            echo -e "$jobscript" >"${job_name}.sh"
+
+            # Call before run function
+            before_run_out="$(before_run "$job_name")"
+
+            # Run the job.
+            run_out="$(launch_job "$job_name")"
+
+            if [ "$?" -ne 0 ]; then
+                echo -e "[ \033[31m FAILED \e[0m ] Could not start processing $job_name"
+                echo "$run_out"
+
+                failed_configs+=("$c")
+            else
+                job_id="$(job_id_from_output "$run_out")"
+
+                jobs_id+=("$job_id")
+                jobs_name+=("$job_name")
+                jobs_config+=("$c")
+            fi
+
+            nruns=$((nruns + 1))
+
+            cd "$current_folder"
+        done
+    done
+
+    #
+    # Wait for the jobs of the round and extract their metric.
+    #
+
+    for i in "${!jobs_id[@]}"; do
+        job_id="${jobs_id[i]}"
+        job_name="${jobs_name[i]}"
+        c="${jobs_config[i]}"
+
+        job_state="$(wait_job "$job_id")"
+
+        metric=""
+        if job_completed "$job_state"; then
+            current_folder="$(pwd)"
+            cd "$job_name"
+            after_run_out="$(after_run "$job_name" 2>&1)"
+            if [[ $? -eq 0 ]]; then
+                metric="$(echo "$after_run_out" | tail -n 1 | tr -d ' ')"
+            fi
+            cd "$current_folder"
+        fi
+
+        if [[ ! "$metric" =~ ^[+-]?[0-9]*\.?[0-9]+([eE][+-]?[0-9]+)?$ ]]; then
+            echo -e "[ \033[31m FAILED \e[0m ] $job_name (${configs[c]})"
+            failed_configs+=("$c")
+            continue
+        fi
+
+        valid_jobs+=("$job_name")
+
+        metric_sum[$c]="$(awk -v s="${metric_sum[c]}" -v m="$metric" 'BEGIN { printf "%.17g", s + m }')"
+        metric_count[$c]=$((metric_count[c] + 1))
+    done
+
+    #
+    # Rank the surviving configurations by their mean metric.
+    #
+
+    ranking=""
+    for c in "${survivors[@]}"; do
+        if [[ " ${failed_configs[*]} " == *" $c "* || ${metric_count[c]} -eq 0 ]]; then
+            # A configuration that fails once is discarded.
+            continue
+        fi
+
+        mean="$(awk -v s="${metric_sum[c]}" -v n="${metric_count[c]}" 'BEGIN { printf "%.6g", s / n }')"
+        ranking+="$mean $c"$'\n'
+    done
+
+    if [[ -z "$ranking" ]]; then
+        echo ""
+        echo -e "[\033[31m  FAILED  \e[0m] Every configuration has failed"
+        survivors=()
+        break
+    fi
+
+    if [[ "$maximize" -eq 1 ]]; then
+        ranking="$(echo -n "$ranking" | sort -g -r -k 1,1)"
+    else
+        ranking="$(echo -n "$ranking" | sort -g -k 1,1)"
+    fi
+
+    best="$(echo "$ranking" | head -n 1 | cut -d ' ' -f 1)"
+
+    # Discard the configurations that are clearly losing.
+    ranking="$(echo "$ranking" | awk -v best="$best" -v cutoff="$cutoff" -v maximize="$maximize" '
+        (maximize == 1 && $1 * cutoff >= best) || (maximize != 1 && $1 <= best * cutoff) { print }')"
+
+    nranked="$(echo "$ranking" | wc -l)"
+    nkeep=$(((nranked + eta - 1) / eta))
+
+    echo ""
+    echo "------------------------------------------------------------------------------"
+    echo "$ranking" | while read -r mean c; do
+        echo "    $mean    ${configs[c]}"
+    done
+    echo "------------------------------------------------------------------------------"
+    echo ""
+
+    survivors=($(echo "$ranking" | head -n "$nkeep" | cut -d ' ' -f 2))
+
+    if [[ ${#survivors[@]} -le 1 ]]; then
+        break
+    fi
+
+    round=$((round + 1))
+    round_reps=$((round_reps * eta))
+done
+
+echo ""
+echo "[==========]"
+
+if [[ ${#survivors[@]} -eq 1 ]]; then
+    c="${survivors[0]}"
+    mean="$(awk -v s="${metric_sum[c]}" -v n="${metric_count[c]}" 'BEGIN { printf "%.6g", s / n }')"
+
+    echo -e "[\033[32m   BEST   \e[0m] ${configs[c]}"
+    echo "[==========] Metric: $mean (mean of ${metric_count[c]} run(s))"
+fi
+
+echo "[==========] $nruns run(s) in $((round + 1)) round(s)"
+echo "[==========] Finished on $(date)"
+
+# Clean all the stage directories of the valid runs.
+if [[ $clean -eq 1 ]]; then
+    for job_name in "${valid_jobs[@]}"; do
+        rm -rf "$job_name"
+    done
+fi
@@ -0,0 +1,63 @@
+#!/bin/bash
+
+# An autotuning template for SLURM and PJM job-schedulers
+
+# Clean the stage folder of the jobs after finishing? 1 -> yes, 0 -> no.
+clean=1
+
+# The name of the job.
+job="test"
+
+# job additional parameters.
+# job_options=(
+#     #    '--exclusive'
+#     # '--time=00:00:01'
+#     # '--qos=debug'
+# )
+
+# Command to tune.
+# You can access the number of mpi-ranks using the environment variable
+# MPI_RANKS and the number of omp-threads using the environment variable
+# OMP_NUM_THREADS:
+# command='command $MPI_RANKS $OMP_NUM_THREADS'
+# OR
+# command="command \$MPI_RANKS \$OMP_NUM_THREADS"
+command='time -p sleep $(awk "BEGIN { print 1 / $OMP_NUM_THREADS + 0.1 * $MPI_RANKS }")'
+
+# Additional arguments to pass to the command.
+command_opts=""
+
+# Number of nodes and number of cores of each node to use.
+nodes=1
+cores=8
+
+# OMP_PROC_BIND and OMP_PLACES values to explore.
+proc_binds=('close' 'spread')
+omp_places=('cores')
+
+#
+# This function is executed before launching a job. You can use this function to
+# prepare the stage folder of the job.
+#
+before_run() (
+    job_name="$1"
+)
+
+#
+# This function is executed when a job has finished. You can use this function to
+# perform a sanity check and to extract the metric of the run.
+#
+# echo: The metric of the run in the last line.
+# return: 0 if the run is correct, 1 otherwise.
+#
+after_run() (
+    job_name="$1"
+
+    wall_time="$(tac "$job_name.err" | grep -m 1 "real" | cut -d ' ' -f 2)"
+
+    echo "$wall_time"
+
+    return 0 # OK
+)
+
+source autotune.sh
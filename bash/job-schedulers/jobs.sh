@@ -0,0 +1,213 @@
+#!/bin/bash
+
+#
+# Helper functions to create, launch and wait for jobs under different
+# job-schedulers. This file is sourced by regression.sh and autotune.sh.
+#
+# Supported job-schedulers: Local, SLURM and PJM.
+#
+# The functions read these (optional) global variables:
+#
+#    Additional arguments to pass to the commands.
+#    command_opts="-s 1"
+#
+#    Maximum allowed execution time of each command.
+#    time="hh:mm:ss"
+#
+#    Run the commands in exclusive mode.
+#    exclusive=1
+#
+#    Scheduler additional parameters.
+#    job_options=(
+#        '--qos=debug'
+#    )
+#
+
+################################################################################
+
+# Detect the job-scheduler
+job_scheduler="NONE"
+if [[ $(which sbatch >/dev/null 2>&1) || $? -eq 0 ]]; then
+    job_scheduler="SLURM"
+elif [[ $(which pjsub >/dev/null 2>&1) || $? -eq 0 ]]; then
+    job_scheduler="PJM"
+fi
+# else -> No job scheduler
+
+#
+# Get the value of a key from a parallelism string.
+#
+# parallelism_value 'nodes=1, mpi=2, omp=4, bind=close' omp -> 4
+#
+parallelism_value() (
+    par="$1"
+    key="$2"
+
+    echo "$par" | sed -n -E "s/.*(^|[ ,])${key}[ ]*=[ ]*([A-Za-z0-9_]+).*/\2/p"
+)
+
+#
+# Create the script of a job.
+#
+# echo: The content of the job script.
+#
+create_jobscript() (
+    job_name="$1"
+    nodes="$2"
+    mpi="$3"
+    omp="$4"
+    command="$5"
+    bind="$6"   # OMP_PROC_BIND (optional).
+    places="$7" # OMP_PLACES (optional).
+
+    jobscript="#!/bin/bash\n"
+
+    if [[ "$job_scheduler" == "SLURM" ]]; then
+        jobscript+="#SBATCH --job-name=$job_name\n"
+        jobscript+="#SBATCH --nodes=$nodes\n"
+        jobscript+="#SBATCH --ntasks=$mpi\n"
+        jobscript+="#SBATCH --cpus-per-task=$omp\n"
+        jobscript+="#SBATCH --output=${job_name}.out\n"
+        jobscript+="#SBATCH --error=${job_name}.err\n"
+
+        if [[ -n "$time" ]]; then
+            jobscript+="#SBATCH --time=${time}\n"
+        fi
+
+        if [[ -n "$exclusive" && $exclusive == 1 ]]; then
+            jobscript+="#SBATCH --exclusive\n"
+        fi
+
+        for job_option in "${job_options[@]}"; do
+            jobscript+="#SBATCH $job_option\n"
+        done
+    elif [[ "$job_scheduler" == "PJM" ]]; then
+        # jobscript+="#PJM -N $job_name\n"
+        jobscript+="#PJM -L node=$nodes\n"
+        jobscript+="#PJM --mpi proc=$mpi\n"
+        jobscript+="#PJM -o ${job_name}.out\n"
+        jobscript+="#PJM -e ${job_name}.err\n"
+
+        if [[ -n "$time" ]]; then
+            jobscript+="#PJM -L elapse=${time}\n"
+        fi
+
+        # if [[ -n "$exclusive" && $exclusive == 1 ]]; then
+        #     jobscript+="#PJM --exclusive\n"
+        # fi
+
+        for job_option in "${job_options[@]}"; do
+            jobscript+="#PJM $job_option\n"
+        done
+    fi
+
+    jobscript+="export MPI_RANKS=$mpi\n"
+    jobscript+="export OMP_NUM_THREADS=$omp\n"
+
+    if [[ -n "$bind" ]]; then
+        jobscript+="export OMP_PROC_BIND=$bind\n"
+    fi
+    if [[ -n "$places" ]]; then
+        jobscript+="export OMP_PLACES=$places\n"
+    fi
+
+    jobscript+="$command $command_opts"
+
+    echo "$jobscript"
+)
+
+#
+# Launch a job. Must be called from the stage folder of the job, where
+# ${job_name}.sh has been created.
+#
+# echo: The output of the job-scheduler.
+# return: 0 if the job was launched, the error code otherwise.
+#
+launch_job() (
+    job_name="$1"
+
+    if [[ "$job_scheduler" == "SLURM" ]]; then
+        sbatch "${job_name}.sh" 2>&1
+    elif [[ "$job_scheduler" == "PJM" ]]; then
+        pjsub "${job_name}.sh" 2>&1
+    else
+        # Execute and wait until finished.
+        bash "${job_name}.sh" 1>"$job_name.out" 2>"$job_name.err"
+    fi
+)
+
+#
+# Get the ID of a job from the output of launch_job.
+#
+# echo: The ID of the job, -1 if there is no job-scheduler.
+#
+job_id_from_output() (
+    run_out="$1"
+
+    if [[ "$job_scheduler" == "SLURM" ]]; then
+        echo "$run_out" | cut -d ' ' -f4
+    elif [[ "$job_scheduler" == "PJM" ]]; then
+        echo "$run_out" | cut -d ' ' -f6
+    else
+        echo "-1"
+    fi
+)
+
+#
+# Wait for a job to finish.
+#
+# echo: The final state of the job.
+#
+wait_job() (
+    job_id="$1"
+
+    job_state=""
+    while :; do
+        sleep 1
+        if [[ "$job_scheduler" == "SLURM" ]]; then
+            job_state="$(sacct -p -n -j $job_id | grep "^$job_id|" | cut -d '|' -f 6)"
+            if [[ -n "$job_state" && "$job_state" != "PENDING" && "$job_state" != "RUNNING" && \
+                "$job_state" != "REQUEUED" && "$job_state" != "RESIZING" && \
+                "$job_state" != "SUSPENDED" && "$job_state" != "REVOKED" ]]; then
+                break
+            fi
+        elif [[ "$job_scheduler" == "PJM" ]]; then
+            job_state="$(pjstat -H -S $job_id | grep "^[ ]*STATE[ ]*:[ ]*" | tr -s ' ' | cut -d ' ' -f 4)"
+            if [[ -n "$job_state" ]]; then
+                # Has finished
+                break
+            fi
+        else
+            # No job scheduler
+            job_state="OK"
+            break
+        fi
+    done
+
+    echo "$job_state"
+)
+
+#
+# return: 0 if the final state of a job means that it has finished correctly,
+#         1 otherwise.
+#
+job_completed() (
+    job_state="$1"
+
+    [[ ("$job_scheduler" == "SLURM" && "$job_state" == "COMPLETED") || \
+       ("$job_scheduler" == "PJM" && "$job_state" == "EXT") || \
+        "$job_state" == "OK" ]]
+)
+
+#
+# Cancel a job.
+#
+cancel_job() (
+    job_id="$1"
+
+    if [[ "$job_scheduler" == "SLURM" ]]; then
+        scancel "$job_id" >/dev/null 2>&1
+    elif [[ "$job_scheduler" == "PJM" ]]; then
+        pjdel "$job_id" >/dev/null 2>&1
+    fi
+)
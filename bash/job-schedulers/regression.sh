@@ -45,6 +45,11 @@
 #        'nodes=1, mpi=1, omp=48'
 #    )
 #
+#    Optionally, OMP_PROC_BIND and OMP_PLACES can also be set:
+#    parallelism=(
+#        'nodes=1, mpi=2, omp=24, bind=close, places=cores'
+#    )
+#
 # Optional variables:
 #    
 #    Maximum allowed execution time of each command.
@@ -89,23 +94,12 @@
 
 ################################################################################
 
-# Detect the job-scheduler
-job_scheduler="NONE"
-if [[ $(which sbatch >/dev/null 2>&1) || $? -eq 0 ]]; then
-    job_scheduler="SLURM"
-elif [[ $(which pjsub >/dev/null 2>&1) || $? -eq 0 ]]; then
-    job_scheduler="PJM"
-fi
-# else -> No job scheduler
+source "$(dirname "${BASH_SOURCE[0]}")/jobs.sh"
 
 # Trap ctrl_c -> Cancel the jobs.
 ctrl_c_trap() (
     for job_id in "${jobs_id[@]}"; do
-        if [[ "$job_scheduler" == "SLURM" ]]; then
-            scancel "$job_id" >/dev/null 2>&1
-        elif [[ "$job_scheduler" == "PJM" ]]; then
-            pjdel "$job_id" >/dev/null 2>&1
-        fi
+        cancel_job "$job_id"
     done
 )
 
@@ -167,52 +161,11 @@ for command in "${commands[@]}"; do
 
         mkdir "$job_name" >/dev/null 2>&1
 
-        # Create the job script
-        jobscript="#!/bin/bash\n"
-
-        if [[ "$job_scheduler" == "SLURM" ]]; then
-            jobscript+="#SBATCH --job-name=$job_name\n"
-            jobscript+="#SBATCH --nodes=$nodes\n"
-            jobscript+="#SBATCH --ntasks=$mpi\n"
-            jobscript+="#SBATCH --cpus-per-task=$omp\n"
-            jobscript+="#SBATCH --output=${job_name}.out\n"
-            jobscript+="#SBATCH --error=${job_name}.err\n"
-
-            if [[ -n "$time" ]]; then
-                jobscript+="#SBATCH --time=${job_name}.err\n"
-            fi
-
-            if [[ -n "$exclusive" && $exclusive == 1 ]]; then
-                jobscript+="#SBATCH --exclusive\n"
-            fi
-
-            for job_option in "${job_options[@]}"; do
-                jobscript+="#SBATCH $job_option\n"
-            done
-        elif [[ "$job_scheduler" == "PJM" ]]; then
-            # jobscript+="#PJM -N $job_name\n"
-            jobscript+="#PJM -L node=$nodes\n"
-            jobscript+="#PJM --mpi proc=$mpi\n"
-            jobscript+="#PJM -o ${job_name}.out\n"
-            jobscript+="#PJM -e ${job_name}.err\n"
-
-            if [[ -n "$time" ]]; then
-                jobscript+="#PJM -L elapse=${job_name}.err\n"
-            fi
-
-            # if [[ -n "$exclusive" && $exclusive == 1 ]]; then
-            #     jobscript+="#PJM --exclusive\n"
-            # fi
-
-            for job_option in "${job_options[@]}"; do
-                jobscript+="#PJM $job_option\n"
-            done
-        fi
-
-        jobscript+="export MPI_RANKS=$mpi\n"
-        jobscript+="export OMP_NUM_THREADS=$omp\n"
+        bind="$(parallelism_value "$par" bind)"
+        places="$(parallelism_value "$par" places)"
 
-        jobscript+="$command $command_opts"
+        # Create the job script
+        jobscript="$(create_jobscript "$job_name" "$nodes" "$mpi" "$omp" "$command" "$bind" "$places")"
 
         # cd to the stage folder of the job.
         current_folder="$(pwd)"
@@ -223,15 +176,7 @@ for command in "${commands[@]}"; do
         before_run_out="$(before_run "$job_name")"
 
         # Run the job.
-        run_out=""
-        if [[ "$job_scheduler" == "SLURM" ]]; then
-            run_out=$(sbatch "${job_name}.sh" 2>&1)
-        elif [[ "$job_scheduler" == "PJM" ]]; then
-            run_out="$(pjsub "${job_name}.sh" 2>&1)"
-        else
-            # Execute and wait until finished.
-            run_out="$(bash "${job_name}.sh" 1>"$job_name.out" 2>"$job_name.err")"
-        fi
+        run_out="$(launch_job "$job_name")"
 
         if [ "$?" -ne 0 ]; then
             echo "[----------]"
@@ -243,11 +188,7 @@ for command in "${commands[@]}"; do
             nfailed_jobs=$((nfailed_jobs + 1))
             jobs_status+=("F") # Failed
         else
-            if [[ "$job_scheduler" == "SLURM" ]]; then
-                job_id="$(echo "$run_out" | cut -d ' ' -f4)"
-            elif [[ "$job_scheduler" == "PJM" ]]; then
-                job_id="$(echo "$run_out" | cut -d ' ' -f6)"
-            fi
+            job_id="$(job_id_from_output "$run_out")"
 
             echo "[----------]"
             echo -e "[ \033[32m RUN \e[0m    ] Started processing $job_name"
@@ -286,35 +227,12 @@ for i in "${!jobs_id[@]}"; do
     omp="${jobs_omp[i]}"
 
     # Wait for job to finish
-    job_state=""
-    while :; do
-        sleep 1
-        if [[ "$job_scheduler" == "SLURM" ]]; then
-            job_state="$(sacct -p -n -j $job_id | grep "^$job_id|" | cut -d '|' -f 6)"
-            if [[ -n "$job_state" && "$job_state" != "PENDING" && "$job_state" != "RUNNING" && \
-                "$job_state" != "REQUEUED" && "$job_state" != "RESIZING" && \
-                "$job_state" != "SUSPENDED" && "$job_state" != "REVOKED" ]]; then
-                break
-            fi
-        elif [[ "$job_scheduler" == "PJM" ]]; then
-            job_state="$(pjstat -H -S $job_id | grep "^[ ]*STATE[ ]*:[ ]*" | tr -s ' ' | cut -d ' ' -f 4)"
-            if [[ -n "$job_state" ]]; then
-                # Has finished
-                break
-            fi
-        else
-            # No job scheduler
-            job_state="OK"
-            break
-        fi
-    done
+    job_state="$(wait_job "$job_id")"
 
     status="$job_state"
     after_run_out=""
 
-    if [[ ("$job_scheduler" == "SLURM" && "$job_state" == "COMPLETED") || \
-           ("$job_scheduler" == "PJM" && "$job_state" == "EXT") || \
-            "$job_state" == "OK" ]]; then
+    if job_completed "$job_state"; then
         #
         # Sanity check
         #
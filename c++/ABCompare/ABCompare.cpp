@@ -0,0 +1,319 @@
+#include "ABCompare.h"
+
+#include "../PerfStat/PerfStat.h"
+#include "../TimeStopwatch/TimeStopwatch.h"
+
+#ifdef HPCTOOLS_DISABLE_INSTRUMENTATION
+#error "ABCompare measures with the stopwatches, build it without HPCTOOLS_DISABLE_INSTRUMENTATION"
+#endif
+
+#include "printer.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+/**
+ * Mean and sample variance of VALUES.
+ *
+ */
+static void mean_variance(const std::vector<double> &values, double &mean, double &variance) {
+    mean = 0;
+    for (const double value : values) {
+        mean += value;
+    }
+    mean /= values.size();
+
+    variance = 0;
+    for (const double value : values) {
+        variance += (value - mean) * (value - mean);
+    }
+    variance = values.size() > 1 ? variance / (values.size() - 1) : 0;
+}
+
+/**
+ * 97.5% quantile of the t distribution with DF degrees of freedom. Up to 30
+ * degrees of freedom it is read from a table, rounding DF down (a wider, safe
+ * interval); above, the Cornish-Fisher expansion around the normal quantile
+ * is accurate enough.
+ *
+ */
+static double t_quantile(const double df) {
+    static const double table[30] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+
+    if (df < 31) {
+        return table[df < 1 ? 0 : (size_t)df - 1];
+    }
+
+    const double z = 1.96;
+    const double z3 = z * z * z;
+    const double z5 = z3 * z * z;
+    const double z7 = z5 * z * z;
+
+    return z + (z3 + z) / (4 * df) + (5 * z5 + 16 * z3 + 3 * z) / (96 * df * df) +
+           (3 * z7 + 19 * z5 + 17 * z3 - 15 * z) / (384 * df * df * df);
+}
+
+/**
+ * Command line of ARGV, for messages. For "sh -c [exec ]COMMAND", just
+ * COMMAND.
+ *
+ */
+static std::string command_line(char *const argv[]) {
+    if (argv[0] != nullptr && argv[1] != nullptr && argv[2] != nullptr &&
+        strcmp(argv[1], "-c") == 0) {
+        return strncmp(argv[2], "exec ", 5) == 0 ? argv[2] + 5 : argv[2];
+    }
+
+    std::string line;
+
+    for (size_t i = 0; argv[i] != nullptr; ++i) {
+        line += i == 0 ? "" : " ";
+        line += argv[i];
+    }
+
+    return line;
+}
+
+ABCompare::ABCompare(const std::vector<PerfStopwatch::Event> &req_events_, const size_t runs_) :
+    req_events(req_events_),
+    runs(runs_ < 2 ? 2 : runs_) {}
+
+void ABCompare::compare(const std::function<void()> &a, const std::function<void()> &b) {
+    metrics.clear();
+
+    PerfStopwatch perf_stopwatch(req_events);
+    const auto events = perf_stopwatch.get_events();
+
+    std::vector<uint64_t> counts(events.size());
+
+    // Warm-up runs (caches, page faults, lazy initialization).
+    a();
+    b();
+
+    for (size_t round = 0; round < runs; ++round) {
+        for (int i = 0; i < 2; ++i) {
+            // ABBA: even rounds run A first, odd rounds run B first.
+            const int variant = (int)(round % 2) ^ i;
+
+            TimeStopwatch time_stopwatch;
+
+            perf_stopwatch.restart();
+            perf_stopwatch.play();
+            time_stopwatch.play();
+
+            if (variant == 0) {
+                a();
+            }
+            else {
+                b();
+            }
+
+            time_stopwatch.pause();
+            perf_stopwatch.pause();
+
+            for (size_t e = 0; e < events.size(); ++e) {
+                counts[e] = perf_stopwatch.get_counter(events[e]);
+            }
+
+            add_run(variant, time_stopwatch.get_s(), events, counts);
+        }
+    }
+}
+
+bool ABCompare::compare(char *const argv_a[], char *const argv_b[]) {
+    metrics.clear();
+
+    char *const *argv[2] = {argv_a, argv_b};
+    bool success = true;
+
+    PerfStat stat(req_events);
+
+    // Warm-up runs (page cache, dynamic loader).
+    for (int variant = 0; variant < 2; ++variant) {
+        const int status = stat.run(argv[variant]);
+
+        if (status != 0) {
+            print_error("ABCompare: %s failed (exit status %d)\n",
+                        command_line(argv[variant]).c_str(), status);
+            return false;
+        }
+    }
+
+    for (size_t round = 0; round < runs; ++round) {
+        for (int i = 0; i < 2; ++i) {
+            // ABBA: even rounds run A first, odd rounds run B first.
+            const int variant = (int)(round % 2) ^ i;
+
+            const int status = stat.run(argv[variant]);
+
+            // The counters of a failed run do not describe the variant.
+            if (status != 0) {
+                print_warning("ABCompare: %s failed (exit status %d), run discarded\n",
+                              command_line(argv[variant]).c_str(), status);
+                success = false;
+                continue;
+            }
+
+            const auto events = stat.get_events();
+            std::vector<uint64_t> counts;
+
+            for (const auto event : events) {
+                counts.push_back(stat.get_counter(event));
+            }
+
+            add_run(variant, stat.get_s(), events, counts);
+        }
+    }
+
+    return success;
+}
+
+void ABCompare::add_run(const int variant, const double secs,
+                        const std::vector<PerfStopwatch::Event> &events,
+                        const std::vector<uint64_t> &counts) {
+
+    std::vector<std::pair<std::string, double>> values;
+
+    values.emplace_back("seconds", secs);
+
+    for (size_t e = 0; e < events.size(); ++e) {
+        values.emplace_back(PerfStopwatch::get_descriptor(events[e]), counts[e]);
+    }
+
+    for (const auto &metric : PerfStat::get_derived(events, counts, secs)) {
+        values.push_back(metric);
+    }
+
+    for (const auto &value : values) {
+        auto metric = std::find_if(metrics.begin(), metrics.end(),
+                                   [&](const Metric &m) { return m.name == value.first; });
+
+        if (metric == metrics.end()) {
+            metrics.push_back({value.first, {}, {}});
+            metric = metrics.end() - 1;
+        }
+
+        (variant == 0 ? metric->a : metric->b).push_back(value.second);
+    }
+}
+
+std::vector<ABCompare::Result> ABCompare::get_results() const {
+    std::vector<Result> results;
+
+    for (const auto &metric : metrics) {
+        if (metric.a.empty() || metric.b.empty()) {
+            continue;
+        }
+
+        Result result;
+        double var_a, var_b;
+
+        result.name = metric.name;
+        mean_variance(metric.a, result.mean_a, var_a);
+        mean_variance(metric.b, result.mean_b, var_b);
+
+        const double se_a = var_a / metric.a.size();
+        const double se_b = var_b / metric.b.size();
+        const double se = sqrt(se_a + se_b);
+
+        // Welch-Satterthwaite degrees of freedom.
+        const double df_den = (metric.a.size() > 1 ? se_a * se_a / (metric.a.size() - 1) : 0) +
+                              (metric.b.size() > 1 ? se_b * se_b / (metric.b.size() - 1) : 0);
+        const double df = df_den == 0 ? 1e9 : (se_a + se_b) * (se_a + se_b) / df_den;
+
+        const double diff = result.mean_b - result.mean_a;
+        const double half_width = t_quantile(df) * se;
+
+        if (result.mean_a == 0) {
+            result.delta = result.ci_lo = result.ci_hi = 0;
+            result.significant = false;
+        }
+        else {
+            const double scale = fabs(result.mean_a);
+
+            result.delta = diff / scale;
+            result.ci_lo = (diff - half_width) / scale;
+            result.ci_hi = (diff + half_width) / scale;
+            result.significant = result.ci_lo > 0 || result.ci_hi < 0;
+        }
+
+        results.push_back(result);
+    }
+
+    return results;
+}
+
+std::string ABCompare::get_explanation(const size_t max_metrics) const {
+    std::vector<Result> changes;
+
+    for (const auto &result : get_results()) {
+        if (result.significant && result.name != "seconds") {
+            changes.push_back(result);
+        }
+    }
+
+    std::sort(changes.begin(), changes.end(), [](const Result &x, const Result &y) {
+        return fabs(x.delta) > fabs(y.delta);
+    });
+
+    std::string explanation;
+    char buffer[128];
+
+    for (size_t i = 0; i < changes.size() && i < max_metrics; ++i) {
+        snprintf(buffer, sizeof(buffer), "%s%+.1lf%% %s", i == 0 ? "" : ", ",
+                 100 * changes[i].delta, changes[i].name.c_str());
+        explanation += buffer;
+    }
+
+    return explanation;
+}
+
+void ABCompare::print_report(FILE *file) const {
+    // Failed runs are discarded, "seconds" holds the runs kept.
+    const size_t runs_a = metrics.empty() ? 0 : metrics[0].a.size();
+    const size_t runs_b = metrics.empty() ? 0 : metrics[0].b.size();
+
+    if (runs_a == runs_b) {
+        fprintf(file, "%lu runs per variant", runs_a);
+    }
+    else {
+        fprintf(file, "%lu runs of A, %lu runs of B", runs_a, runs_b);
+    }
+    fprintf(file, ", ABBA order, * = significant (95%% CI excludes 0)\n\n");
+    fprintf(file, "%24s  %14s  %14s  %9s  %22s\n", "metric", "A", "B", "delta", "95% CI");
+
+    const auto results = get_results();
+
+    for (const auto &result : results) {
+        fprintf(file, "%24s  %14.6lg  %14.6lg  %+8.2lf%%  [%+8.2lf%%, %+8.2lf%%] %s\n",
+                result.name.c_str(), result.mean_a, result.mean_b, 100 * result.delta,
+                100 * result.ci_lo, 100 * result.ci_hi, result.significant ? "*" : "");
+    }
+
+    if (results.empty()) {
+        return;
+    }
+
+    const Result &time = results[0];
+    const std::string explanation = get_explanation();
+
+    fprintf(file, "\nB takes ");
+    if (time.significant) {
+        fprintf(file, "%.1lf%% %s time than A", 100 * fabs(time.delta),
+                time.delta < 0 ? "less" : "more");
+    }
+    else {
+        fprintf(file, "the same time as A (no significant difference)");
+    }
+
+    if (!explanation.empty()) {
+        fprintf(file, ": %s", explanation.c_str());
+    }
+
+    fprintf(file, "\n");
+}
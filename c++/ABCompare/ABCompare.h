@@ -0,0 +1,119 @@
+#pragma once
+
+#include "../PerfStopwatch/PerfStopwatch.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * @author Lorién López Villellas (lorien.lopez@bsc.es)
+ *
+ * A module for comparing two variants of a code (A and B): two functions of
+ * the same program or two binaries (see abcompare.cpp).
+ *
+ * Variants are run in alternation (ABBA ABBA...) by the same thread, so both
+ * of them run on the same node, with the same pinning, and are equally
+ * affected by slow drifts (frequency, temperature, other jobs). Every run
+ * records the time, the requested events and the derived metrics of
+ * PerfStat (IPC, miss ratios...).
+ *
+ * For every metric, the report shows the mean of A and B, the relative delta
+ * of B and its 95% confidence interval (Welch's t-test). A metric is flagged
+ * as significant if the interval does not contain 0. The significant
+ * changes of the counters and the derived metrics explain the change of the
+ * time, e.g. "-35.0% LL read misses, +12.0% IPC".
+ *
+ * Pinning is not changed: both variants inherit the one of the launcher
+ * (taskset, numactl, OMP_PROC_BIND...).
+ *
+ * The interval of the relative delta ignores the uncertainty of the mean of
+ * A, it is accurate while the interval of A is narrow.
+ *
+ * Warning: Functions are measured with a PerfStopwatch, so the threads they
+ * use must be created after compare() is called (see PerfStopwatch).
+ */
+
+class ABCompare {
+public:
+    // Statistics of a metric.
+    struct Result {
+        std::string name;
+        double mean_a;
+        double mean_b;
+        double delta;    // (mean_b - mean_a) / mean_a.
+        double ci_lo;    // 95% confidence interval of delta.
+        double ci_hi;
+        bool significant; // The interval does not contain 0.
+    };
+
+    /**
+     * Initializes the comparison.
+     *
+     * @param req_events_ perf events to count.
+     * @param runs_ Runs of every variant (plus one discarded warm-up run).
+     */
+    ABCompare(const std::vector<PerfStopwatch::Event> &req_events_, const size_t runs_ = 10);
+
+    /**
+     * Compare two functions.
+     *
+     * @param a Variant A.
+     * @param b Variant B.
+     */
+    void compare(const std::function<void()> &a, const std::function<void()> &b);
+
+    /**
+     * Compare two commands (run by PerfStat). Failed runs are reported and
+     * left out of the comparison.
+     *
+     * @param argv_a Command and arguments of variant A (nullptr terminated).
+     * @param argv_b Command and arguments of variant B (nullptr terminated).
+     * @return true if every run succeeded, false otherwise.
+     */
+    bool compare(char *const argv_a[], char *const argv_b[]);
+
+    /**
+     * Print the comparison into FILE.
+     *
+     */
+    void print_report(FILE *file = stdout) const;
+
+    /**
+     * Get the statistics of every metric (time first).
+     *
+     */
+    std::vector<Result> get_results() const;
+
+    /**
+     * Get the explanation of the change: significant changes of the counters
+     * and the derived metrics, biggest first.
+     *
+     * @param max_metrics Max. metrics listed.
+     */
+    std::string get_explanation(const size_t max_metrics = 5) const;
+
+private:
+    // Samples of a metric.
+    struct Metric {
+        std::string name;
+        std::vector<double> a;
+        std::vector<double> b;
+    };
+
+    std::vector<PerfStopwatch::Event> req_events;
+    size_t runs;
+
+    std::vector<Metric> metrics;
+
+    /**
+     * Add the samples of a run.
+     *
+     * @param variant 0 (A) or 1 (B).
+     */
+    void add_run(const int variant, const double secs,
+                 const std::vector<PerfStopwatch::Event> &events,
+                 const std::vector<uint64_t> &counts);
+};
@@ -0,0 +1,124 @@
+/**
+ * @author Lorién López Villellas (lorien.lopez@bsc.es)
+ *
+ * Compare two builds or variants of a command (see ABCompare). Both commands
+ * are run by the shell, in alternation, and their outputs are discarded by
+ * the caller if needed ("./app_a > /dev/null").
+ *
+ * Usage: abcompare [-n runs] [-e event,event,...] "command A" "command B"
+ *
+ * Events are PerfStopwatch descriptors, '-' or '_' can replace the spaces
+ * ("-e cpu-cycles,instructions,LL-read-misses"). Pin the launcher to pin both
+ * variants:
+ *
+ *    taskset -c 0-7 abcompare -n 20 "./app_old input.dat" "./app_new input.dat"
+ *
+ * The exit status is 0 if every run succeeded, 1 otherwise.
+ */
+
+#include "ABCompare.h"
+
+#include "../PerfStat/PerfStat.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Print the usage.
+ *
+ */
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-n runs] [-e event,event,...] \"command A\" \"command B\"\n",
+            program);
+}
+
+/**
+ * Shell command that runs COMMAND. A simple command ("./app input.dat") is
+ * prefixed with exec, so the shell is replaced and only its startup is
+ * measured. Commands with leading variable assignments, pipelines, lists or
+ * compound commands are left to the shell as they are.
+ *
+ */
+static std::string shell_command(const char *command) {
+    static const char *const reserved[] = {"if", "for", "while", "until", "case", "{", "!"};
+
+    const char *first_word = command + strspn(command, " \t");
+    const std::string word(first_word, strcspn(first_word, " \t"));
+
+    if (strpbrk(command, ";&|()\n") != nullptr || word.find('=') != std::string::npos) {
+        return command;
+    }
+
+    for (const char *keyword : reserved) {
+        if (word == keyword) {
+            return command;
+        }
+    }
+
+    return std::string("exec ") + command;
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<PerfStopwatch::Event> events = PerfStat::default_events();
+    size_t runs = 10;
+
+    int arg = 1;
+    while (arg < argc && argv[arg][0] == '-') {
+        const std::string option(argv[arg]);
+
+        if (option == "--") {
+            ++arg;
+            break;
+        }
+        else if (option == "-n" && arg + 1 < argc) {
+            runs = strtoul(argv[arg + 1], nullptr, 10);
+            arg += 2;
+        }
+        else if (option == "-e" && arg + 1 < argc) {
+            events.clear();
+
+            std::stringstream names(argv[arg + 1]);
+            std::string name;
+
+            while (std::getline(names, name, ',')) {
+                PerfStopwatch::Event event;
+
+                if (!PerfStat::parse_event(name, event)) {
+                    fprintf(stderr, "Unknown event %s\n", name.c_str());
+                    return 1;
+                }
+
+                events.push_back(event);
+            }
+
+            arg += 2;
+        }
+        else {
+            usage(argv[0]);
+            return option == "-h" ? 0 : 1;
+        }
+    }
+
+    if (argc - arg != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::string commands[2] = {shell_command(argv[arg]), shell_command(argv[arg + 1])};
+
+    char *argv_a[] = {(char *)"/bin/sh", (char *)"-c", &commands[0][0], nullptr};
+    char *argv_b[] = {(char *)"/bin/sh", (char *)"-c", &commands[1][0], nullptr};
+
+    ABCompare ab(events, runs);
+
+    const bool success = ab.compare(argv_a, argv_b);
+
+    printf("A: %s\nB: %s\n", argv[arg], argv[arg + 1]);
+    ab.print_report(stdout);
+
+    return success ? 0 : 1;
+}
@@ -0,0 +1,495 @@
+/**
+ * @author Lorién López Villellas (lorien.lopez@bsc.es)
+ *
+ * A suite for characterizing the cache hierarchy, the TLB and the memory
+ * bandwidth of a node, and for checking that the PerfStopwatch cache events
+ * count what they are expected to count:
+ *
+ *   - Latency: pointer chase (one dependent load per cache line, random
+ *     order) over growing working sets. The knees of the latency curve are
+ *     the cache sizes.
+ *   - Bandwidth: streaming read, write and copy over arrays of 4x the LLC
+ *     size, for 1, 2, 4... threads (OpenMP, static schedule).
+ *   - TLB reach: pointer chase touching one line per base page (transparent
+ *     huge pages disabled) over a growing number of pages. The knees are the
+ *     TLB sizes.
+ *
+ * Every test records the L1D, LL and DTLB read events alongside the time and
+ * reports them per load (or per cache line). Counters are inherited by the
+ * OpenMP threads and reading them adds the counts of the live threads, so the
+ * bandwidth test divides by every line streamed by the team.
+ *
+ * At the end, the sanity checks compare the counters with the expected values
+ * (e.g. ~1 LL miss per cache line streamed from DRAM).
+ *
+ * Usage: cachebench [max working set (MiB), 256] [max threads, OMP_NUM_THREADS]
+ *
+ * The max working set bounds the latency and TLB tests, it must be at least
+ * 1 MiB.
+ */
+
+#include "../PerfStopwatch/PerfStopwatch.h"
+#include "../TimeStopwatch/TimeStopwatch.h"
+
+#ifdef HPCTOOLS_DISABLE_INSTRUMENTATION
+#error "cachebench measures with the stopwatches, build it without HPCTOOLS_DISABLE_INSTRUMENTATION"
+#endif
+
+#include <omp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+static const size_t CACHE_LINE_SIZE = 64;
+
+// Dependent loads of every latency measurement.
+static const size_t CHASE_STEPS = 1 << 22;
+
+// Repetitions of every bandwidth measurement (the best one is reported).
+static const int STREAM_REPS = 5;
+
+// LLC size assumed when it cannot be read.
+static const size_t DEFAULT_LLC_SIZE = 32UL * 1024 * 1024;
+
+// A latency step bigger than this is a knee.
+static const double KNEE_RATIO = 1.3;
+
+// A cache line of a pointer chase.
+struct Line {
+    Line *next;
+    char pad[CACHE_LINE_SIZE - sizeof(Line *)];
+};
+
+// Events recorded by every test.
+static const std::vector<PerfStopwatch::Event> events = {
+    PerfStopwatch::L1D_READ_ACCESS,
+    PerfStopwatch::L1D_READ_MISSES,
+    PerfStopwatch::LL_READ_ACCESS,
+    PerfStopwatch::LL_READ_MISSES,
+    PerfStopwatch::DTLB_READ_ACCESS,
+    PerfStopwatch::DTLB_READ_MISSES,
+};
+
+// A point of a latency or TLB curve.
+struct Point {
+    size_t size;     // Working set (bytes) or pages.
+    double ns;       // ns per load.
+    double l1d_miss; // Misses per load, -1 if the event is not available.
+    double ll_miss;
+    double dtlb_miss;
+};
+
+// A sanity check.
+struct Check {
+    std::string name;
+    double value;
+    double lo;
+    double hi;
+};
+
+static std::vector<Check> checks;
+
+// Prevents the compiler from removing the loads.
+static volatile uintptr_t sink;
+
+/**
+ * Get a counter per unit, -1 if the event is not available.
+ *
+ */
+static double per(const PerfStopwatch &stopwatch, const PerfStopwatch::Event event,
+                  const double units) {
+    const auto tracked = stopwatch.get_events();
+
+    if (std::find(tracked.begin(), tracked.end(), event) == tracked.end() || units == 0) {
+        return -1;
+    }
+
+    return stopwatch.get_counter(event) / units;
+}
+
+/**
+ * Print a counter per unit ("n/a" if not available).
+ *
+ */
+static void print_per(const double value) {
+    if (value < 0) {
+        printf(" %10s", "n/a");
+    }
+    else {
+        printf(" %10.3lf", value);
+    }
+}
+
+/**
+ * Add a sanity check (skipped if the counter is not available).
+ *
+ */
+static void add_check(const std::string &name, const double value, const double lo,
+                      const double hi) {
+    if (value >= 0) {
+        checks.push_back({name, value, lo, hi});
+    }
+}
+
+/**
+ * Allocate a page-aligned buffer, backed by huge pages if possible or by
+ * base pages only.
+ *
+ */
+static void *allocate(const size_t size, const bool huge_pages) {
+    const size_t alignment = 2 * 1024 * 1024;
+    const size_t aligned_size = (size + alignment - 1) / alignment * alignment;
+
+    void *buffer = nullptr;
+    if (posix_memalign(&buffer, alignment, aligned_size) != 0) {
+        fprintf(stderr, "Error allocating %zu bytes\n", size);
+        exit(1);
+    }
+
+    madvise(buffer, aligned_size, huge_pages ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+
+    return buffer;
+}
+
+/**
+ * Link lines[order[i]] -> lines[order[i + 1]] into a cycle.
+ *
+ */
+static Line *link(char *base, const std::vector<size_t> &offsets) {
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        Line *line = reinterpret_cast<Line *>(base + offsets[i]);
+        line->next = reinterpret_cast<Line *>(base + offsets[(i + 1) % offsets.size()]);
+    }
+
+    return reinterpret_cast<Line *>(base + offsets[0]);
+}
+
+/**
+ * Chase a cycle of lines and measure it.
+ *
+ */
+static Point chase(Line *first, const size_t size, PerfStopwatch &perf) {
+    // Warm up.
+    Line *line = first;
+    for (size_t i = 0; i < CHASE_STEPS / 4; ++i) {
+        line = line->next;
+    }
+
+    TimeStopwatch time;
+
+    perf.restart();
+    perf.play();
+    time.play();
+
+    for (size_t i = 0; i < CHASE_STEPS; ++i) {
+        line = line->next;
+    }
+
+    time.pause();
+    perf.pause();
+
+    sink = reinterpret_cast<uintptr_t>(line);
+
+    return {size,
+            time.get_s() * 1e9 / CHASE_STEPS,
+            per(perf, PerfStopwatch::L1D_READ_MISSES, CHASE_STEPS),
+            per(perf, PerfStopwatch::LL_READ_MISSES, CHASE_STEPS),
+            per(perf, PerfStopwatch::DTLB_READ_MISSES, CHASE_STEPS)};
+}
+
+/**
+ * Print a curve and its knees (the last size before every latency step).
+ *
+ */
+static void print_curve(const std::vector<Point> &curve, const char *unit, const size_t divisor) {
+    printf("%14s %10s %10s %10s %10s\n", unit, "ns/load", "L1D miss", "LL miss", "DTLB miss");
+
+    for (const auto &point : curve) {
+        printf("%14zu %10.2lf", point.size / divisor, point.ns);
+        print_per(point.l1d_miss);
+        print_per(point.ll_miss);
+        print_per(point.dtlb_miss);
+        printf("\n");
+    }
+
+    printf("Knees (%s):", unit);
+
+    // Compare with the plateau, not with the previous point, so slow ramps
+    // are detected too.
+    double plateau = curve.empty() ? 0 : curve[0].ns;
+    bool found = false;
+
+    for (size_t i = 1; i < curve.size(); ++i) {
+        if (curve[i].ns > plateau * KNEE_RATIO) {
+            printf(" %zu", curve[i - 1].size / divisor);
+            plateau = curve[i].ns;
+            found = true;
+        }
+    }
+
+    printf("%s\n\n", found ? "" : " none");
+}
+
+/**
+ * Pointer chase over growing working sets.
+ *
+ */
+static void latency_test(const size_t max_size, PerfStopwatch &perf, std::mt19937_64 &rng) {
+    printf("=== Latency (pointer chase, random lines) ===\n");
+
+    char *buffer = static_cast<char *>(allocate(max_size, true));
+    std::vector<Point> curve;
+
+    for (size_t size = 4096; size <= max_size; size *= 2) {
+        std::vector<size_t> offsets(size / CACHE_LINE_SIZE);
+        for (size_t i = 0; i < offsets.size(); ++i) {
+            offsets[i] = i * CACHE_LINE_SIZE;
+        }
+        std::shuffle(offsets.begin(), offsets.end(), rng);
+
+        curve.push_back(chase(link(buffer, offsets), size, perf));
+    }
+
+    print_curve(curve, "KiB", 1024);
+
+    // The smallest working set fits in L1D, the biggest one in none.
+    add_check("chase 4 KiB: L1D misses per load ~0", curve.front().l1d_miss, 0, 0.05);
+    add_check("chase 4 KiB: LL misses per load ~0", curve.front().ll_miss, 0, 0.05);
+    if (max_size >= 256UL * 1024 * 1024) {
+        add_check("chase max: L1D misses per load ~1", curve.back().l1d_miss, 0.8, 1.2);
+        add_check("chase max: LL misses per load ~1", curve.back().ll_miss, 0.5, 1.2);
+    }
+
+    free(buffer);
+}
+
+/**
+ * Pointer chase touching one line per base page over a growing number of
+ * pages.
+ *
+ */
+static void tlb_test(const size_t max_size, PerfStopwatch &perf, std::mt19937_64 &rng) {
+    printf("=== TLB reach (one line per base page, random pages) ===\n");
+
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t max_pages = std::min(max_size / page_size, (size_t)1 << 16);
+
+    char *buffer = static_cast<char *>(allocate(max_pages * page_size, false));
+    std::vector<Point> curve;
+
+    for (size_t pages = 4; pages <= max_pages; pages *= 2) {
+        // Rotate the line inside every page so that the lines do not compete
+        // for the same cache sets.
+        std::vector<size_t> offsets(pages);
+        for (size_t p = 0; p < pages; ++p) {
+            offsets[p] = p * page_size + (p % (page_size / CACHE_LINE_SIZE)) * CACHE_LINE_SIZE;
+        }
+        std::shuffle(offsets.begin(), offsets.end(), rng);
+
+        curve.push_back(chase(link(buffer, offsets), pages, perf));
+    }
+
+    print_curve(curve, "pages", 1);
+
+    add_check("TLB 4 pages: DTLB misses per load ~0", curve.front().dtlb_miss, 0, 0.05);
+    if (max_pages >= (1 << 16)) {
+        add_check("TLB max: DTLB misses per load ~1", curve.back().dtlb_miss, 0.5, 1.2);
+    }
+
+    free(buffer);
+}
+
+/**
+ * Size in bytes of the last level cache of CPU 0, from sysfs or, failing
+ * that, sysconf. DEFAULT_LLC_SIZE if neither knows it.
+ *
+ */
+static size_t llc_size() {
+    const std::string path = "/sys/devices/system/cpu/cpu0/cache/index";
+    int llc_level = 0;
+    size_t size = 0;
+
+    for (int index = 0;; ++index) {
+        std::ifstream level_file(path + std::to_string(index) + "/level");
+        std::ifstream size_file(path + std::to_string(index) + "/size");
+        int level;
+        size_t index_size;
+        std::string unit;
+
+        if (!(level_file >> level) || !(size_file >> index_size)) {
+            break;
+        }
+
+        size_file >> unit;
+        index_size *= unit == "K" ? 1024 : unit == "M" ? 1024 * 1024 : 1;
+
+        if (level > llc_level || (level == llc_level && index_size > size)) {
+            llc_level = level;
+            size = index_size;
+        }
+    }
+
+    if (size == 0) {
+        const long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+        const long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+
+        size = l3 > 0 ? l3 : l2 > 0 ? l2 : DEFAULT_LLC_SIZE;
+    }
+
+    return size;
+}
+
+/**
+ * Streaming read, write and copy for 1, 2, 4... threads.
+ *
+ */
+static void bandwidth_test(const size_t size, const int max_threads, PerfStopwatch &perf) {
+    printf("=== Bandwidth (%zu MiB arrays, static schedule) ===\n", size >> 20);
+
+    const size_t n = size / sizeof(double);
+
+    double *a = static_cast<double *>(allocate(size, true));
+    double *b = static_cast<double *>(allocate(size, true));
+
+    // First touch by every thread.
+#pragma omp parallel for schedule(static) num_threads(max_threads)
+    for (size_t i = 0; i < n; ++i) {
+        a[i] = 1.0;
+        b[i] = 2.0;
+    }
+
+    printf("%8s %10s %10s %10s %12s %12s %12s\n", "threads", "read GB/s", "write GB/s",
+           "copy GB/s", "read LL/line", "L1D/line", "DTLB/line");
+
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        double best[3] = {0, 0, 0};
+        double ll_per_line = -1;
+        double l1d_per_line = -1;
+        double dtlb_per_line = -1;
+
+        for (int test = 0; test < 3; ++test) {
+            perf.restart();
+
+            for (int rep = 0; rep < STREAM_REPS; ++rep) {
+                TimeStopwatch time;
+                double sum = 0;
+
+                if (test == 0) {
+                    perf.play();
+                }
+                time.play();
+
+                if (test == 0) {
+#pragma omp parallel for schedule(static) num_threads(threads) reduction(+ : sum)
+                    for (size_t i = 0; i < n; ++i) {
+                        sum += a[i];
+                    }
+                }
+                else if (test == 1) {
+#pragma omp parallel for schedule(static) num_threads(threads)
+                    for (size_t i = 0; i < n; ++i) {
+                        a[i] = 1.0;
+                    }
+                }
+                else {
+#pragma omp parallel for schedule(static) num_threads(threads)
+                    for (size_t i = 0; i < n; ++i) {
+                        b[i] = a[i];
+                    }
+                }
+
+                time.pause();
+                if (test == 0) {
+                    perf.pause();
+                }
+
+                sink = (uintptr_t)sum;
+
+                const double bytes = test == 2 ? 2.0 * size : size;
+                best[test] = std::max(best[test], bytes / time.get_s() / 1e9);
+            }
+
+            if (test == 0) {
+                // Lines streamed by every thread of the team.
+                const double lines = (double)size / CACHE_LINE_SIZE * STREAM_REPS;
+
+                ll_per_line = per(perf, PerfStopwatch::LL_READ_MISSES, lines);
+                l1d_per_line = per(perf, PerfStopwatch::L1D_READ_MISSES, lines);
+                dtlb_per_line = per(perf, PerfStopwatch::DTLB_READ_MISSES, lines);
+            }
+        }
+
+        printf("%8d %10.2lf %10.2lf %10.2lf", threads, best[0], best[1], best[2]);
+        printf("  ");
+        print_per(ll_per_line);
+        printf("  ");
+        print_per(l1d_per_line);
+        printf("  ");
+        print_per(dtlb_per_line);
+        printf("\n");
+
+        if (threads == 1) {
+            // Every line comes from DRAM and misses L1D once. Prefetchers may
+            // turn demand misses into hits, hence the wide range.
+            add_check("stream read: LL misses per line ~1", ll_per_line, 0.5, 1.5);
+            add_check("stream read: L1D misses per line ~1", l1d_per_line, 0.5, 1.5);
+        }
+    }
+
+    printf("\n");
+
+    free(a);
+    free(b);
+}
+
+int main(int argc, char *argv[]) {
+    const long max_mib = argc > 1 ? atol(argv[1]) : 256;
+    const int max_threads = argc > 2 ? atoi(argv[2]) : omp_get_max_threads();
+
+    if (max_mib < 1 || max_threads < 1) {
+        fprintf(stderr, "Usage: %s [max working set (MiB) >= 1, 256] [max threads >= 1, "
+                        "OMP_NUM_THREADS]\n", argv[0]);
+        return 1;
+    }
+
+    const size_t max_size = (size_t)max_mib * 1024 * 1024;
+
+    // Counters must be opened before the OpenMP threads are created to be
+    // inherited by them.
+    PerfStopwatch perf(events);
+
+    std::mt19937_64 rng(12345);
+
+    latency_test(max_size, perf, rng);
+    tlb_test(max_size, perf, rng);
+    // Rounded up to whole MiB for the report.
+    const size_t stream_size = ((4 * llc_size() + (1 << 20) - 1) >> 20) << 20;
+    bandwidth_test(stream_size, max_threads, perf);
+
+    printf("=== Sanity checks ===\n");
+
+    int failed = 0;
+    for (const auto &check : checks) {
+        const bool ok = check.value >= check.lo && check.value <= check.hi;
+
+        printf("%-40s %8.3lf [%.2lf, %.2lf] %s\n", check.name.c_str(), check.value, check.lo,
+               check.hi, ok ? "OK" : "FAIL");
+
+        failed += !ok;
+    }
+
+    if (checks.empty()) {
+        printf("No cache events available\n");
+    }
+
+    return failed == 0 ? 0 : 1;
+}
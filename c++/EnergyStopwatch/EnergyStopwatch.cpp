@@ -0,0 +1,334 @@
+#define _GNU_SOURCE 1
+
+#include "EnergyStopwatch.h"
+
+#include "../SysFiles/SysFiles.h"
+
+#include "printer.h"
+
+#include <asm/unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <stdexcept>
+
+// Domain description.
+const char *EnergyStopwatch::descriptors[NUM_DOMAINS] = {
+    "package",
+    "cores",
+    "DRAM",
+    "psys",
+};
+
+// Name of the events of the power PMU.
+static const char *perf_events[EnergyStopwatch::NUM_DOMAINS] = {
+    "energy-pkg",
+    "energy-cores",
+    "energy-ram",
+    "energy-psys",
+};
+
+// Name of the powercap zones.
+static const char *powercap_zones[EnergyStopwatch::NUM_DOMAINS] = {
+    "package",
+    "core",
+    "dram",
+    "psys",
+};
+
+static const std::string POWER_PMU_PATH = "/sys/bus/event_source/devices/power";
+static const std::string POWERCAP_PATH = "/sys/class/powercap";
+
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+/**
+ * Seconds between two timestamps.
+ *
+ */
+static double elapsed_s(const timespec &start, const timespec &stop) {
+    return (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1000000000.0;
+}
+#endif
+
+EnergyStopwatch::EnergyStopwatch(const std::vector<Domain> &req_domains_) :
+    source(NONE),
+    req_domains(req_domains_),
+    counters(req_domains_.size()),
+    total_joules(req_domains_.size()),
+    total_secs(0) {
+
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+    if (open_perf()) {
+        source = PERF;
+    }
+    else if (open_powercap()) {
+        source = POWERCAP;
+    }
+    else {
+        print_error("EnergyStopwatch: RAPL is not available\n");
+    }
+
+    for (size_t i = 0; i < req_domains.size(); ++i) {
+        if (source != NONE && counters[i].empty()) {
+            print_warning("EnergyStopwatch: Domain %s is not available\n",
+                          get_descriptor(req_domains[i]));
+        }
+    }
+#endif
+
+    restart();
+}
+
+EnergyStopwatch::~EnergyStopwatch() {
+    close_counters();
+}
+
+void EnergyStopwatch::restart() {
+    for (auto &joules : total_joules) {
+        joules = 0;
+    }
+
+    total_secs = 0;
+}
+
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+void EnergyStopwatch::play() {
+    for (auto &domain_counters : counters) {
+        for (auto &counter : domain_counters) {
+            if (!read_counter(counter, counter.start)) {
+                print_error("%16s: ERROR reading energy counter.\n", "EnergyStopwatch");
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+}
+
+void EnergyStopwatch::pause() {
+    timespec stop_time;
+    clock_gettime(CLOCK_MONOTONIC, &stop_time);
+
+    total_secs += elapsed_s(start_time, stop_time);
+
+    for (size_t i = 0; i < req_domains.size(); ++i) {
+        for (auto &counter : counters[i]) {
+            uint64_t stop_count;
+
+            if (!read_counter(counter, stop_count)) {
+                print_error("%16s: ERROR reading energy counter.\n", get_descriptor(req_domains[i]));
+                continue;
+            }
+
+            // powercap counters wrap around to 0 after max_range. perf
+            // counters are 64-bit, the kernel handles the wraparound of the
+            // MSRs.
+            const uint64_t delta = stop_count >= counter.start
+                                       ? stop_count - counter.start
+                                       : counter.max_range - counter.start + stop_count + 1;
+
+            total_joules[i] += delta * counter.scale;
+        }
+    }
+}
+#endif
+
+void EnergyStopwatch::print_all_counters() const {
+    for (size_t i = 0; i < req_domains.size(); ++i) {
+        if (!counters[i].empty()) {
+            printf("%16s: %14.3lf J %10.3lf W\n", get_descriptor(req_domains[i]), total_joules[i],
+                   total_secs > 0 ? total_joules[i] / total_secs : 0.0);
+        }
+    }
+}
+
+double EnergyStopwatch::get_joules(const Domain target_domain) const {
+    for (size_t i = 0; i < req_domains.size(); ++i) {
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+        if (req_domains[i] == target_domain && !counters[i].empty()) {
+#else
+        // No counter is opened, requested domains read 0.
+        if (req_domains[i] == target_domain) {
+#endif
+            return total_joules[i];
+        }
+    }
+
+    throw std::runtime_error("EnergyStopwatch: Trying to read a non tracked domain");
+}
+
+double EnergyStopwatch::get_watts(const Domain target_domain) const {
+    const double joules = get_joules(target_domain);
+
+    return total_secs > 0 ? joules / total_secs : 0.0;
+}
+
+double EnergyStopwatch::get_s() const {
+    return total_secs;
+}
+
+double EnergyStopwatch::get_energy_to_solution() const {
+    double joules = 0;
+    bool tracked = false;
+
+    for (size_t i = 0; i < req_domains.size(); ++i) {
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+        if ((req_domains[i] == PACKAGE || req_domains[i] == DRAM) && !counters[i].empty()) {
+#else
+        if (req_domains[i] == PACKAGE || req_domains[i] == DRAM) {
+#endif
+            joules += total_joules[i];
+            tracked = true;
+        }
+    }
+
+    return tracked ? joules : get_joules(PSYS);
+}
+
+double EnergyStopwatch::get_gflops_per_joule(const uint64_t flops) const {
+    const double joules = get_energy_to_solution();
+
+    return joules > 0 ? flops / joules / 1e9 : 0.0;
+}
+
+EnergyStopwatch::Source EnergyStopwatch::get_source() const {
+    return source;
+}
+
+const char *EnergyStopwatch::get_descriptor(const Domain target_domain) {
+    return descriptors[target_domain];
+}
+
+bool EnergyStopwatch::open_perf() {
+    const std::string pmu_type = read_line(POWER_PMU_PATH + "/type");
+    if (pmu_type.empty()) {
+        return false;
+    }
+
+    // One CPU of each package.
+    const std::vector<int> cpus = parse_list(read_line(POWER_PMU_PATH + "/cpumask"));
+
+    bool opened = false;
+
+    for (size_t i = 0; i < req_domains.size(); ++i) {
+        const std::string event = POWER_PMU_PATH + "/events/" + perf_events[req_domains[i]];
+
+        unsigned long config;
+        if (sscanf(read_line(event).c_str(), "event=%lx", &config) != 1) {
+            continue;
+        }
+
+        // Joules per count. Without it the counts can not be converted.
+        const double scale = atof(read_line(event + ".scale").c_str());
+
+        if (scale <= 0) {
+            continue;
+        }
+
+        for (const auto &cpu : cpus) {
+            struct perf_event_attr pe;
+
+            memset(&pe, 0, sizeof(struct perf_event_attr));
+            pe.size = sizeof(struct perf_event_attr);
+            pe.type = atoi(pmu_type.c_str());
+            pe.config = config;
+
+            // System-wide counter of the package of CPU.
+            const int fd = syscall(__NR_perf_event_open, &pe, -1, cpu, -1, 0);
+
+            if (fd == -1) {
+                // Probably not allowed, fall back to powercap.
+                close_counters();
+                return false;
+            }
+
+            counters[i].push_back({fd, scale, UINT64_MAX, 0});
+            opened = true;
+        }
+    }
+
+    return opened;
+}
+
+bool EnergyStopwatch::open_powercap() {
+    DIR *dir = opendir(POWERCAP_PATH.c_str());
+    if (dir == nullptr) {
+        return false;
+    }
+
+    // Zones are intel-rapl:<package> and intel-rapl:<package>:<subzone>.
+    std::vector<std::string> zones;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        const std::string name(entry->d_name);
+
+        if (name.find("intel-rapl:") == 0) {
+            zones.push_back(POWERCAP_PATH + "/" + name);
+        }
+    }
+
+    closedir(dir);
+
+    std::sort(zones.begin(), zones.end());
+
+    bool opened = false;
+
+    for (const auto &zone : zones) {
+        // "package-0", "core", "dram", "psys"...
+        const std::string zone_name = read_line(zone + "/name");
+
+        for (size_t i = 0; i < req_domains.size(); ++i) {
+            if (zone_name.find(powercap_zones[req_domains[i]]) != 0) {
+                continue;
+            }
+
+            const int fd = open((zone + "/energy_uj").c_str(), O_RDONLY);
+
+            if (fd == -1) {
+                print_error("Error opening %s/energy_uj %s\n", zone.c_str(), strerror(errno));
+                continue;
+            }
+
+            const uint64_t max_range = strtoull(read_line(zone + "/max_energy_range_uj").c_str(),
+                                                NULL, 10);
+
+            counters[i].push_back({fd, 1e-6, max_range, 0});
+            opened = true;
+        }
+    }
+
+    return opened;
+}
+
+bool EnergyStopwatch::read_counter(const Counter &counter, uint64_t &value) const {
+    if (source == PERF) {
+        return sizeof(uint64_t) == read(counter.fd, &value, sizeof(uint64_t));
+    }
+
+    char buffer[32];
+    const ssize_t size = pread(counter.fd, buffer, sizeof(buffer) - 1, 0);
+
+    if (size <= 0) {
+        return false;
+    }
+
+    buffer[size] = '\0';
+    value = strtoull(buffer, NULL, 10);
+
+    return true;
+}
+
+void EnergyStopwatch::close_counters() {
+    for (auto &domain_counters : counters) {
+        for (const auto &counter : domain_counters) {
+            close(counter.fd);
+        }
+        domain_counters.clear();
+    }
+}
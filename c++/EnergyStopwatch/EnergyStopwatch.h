@@ -0,0 +1,205 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+/**
+ * @author Lorién López Villellas (lorien.lopez@bsc.es)
+ *
+ * A module for measuring energy using RAPL (Running Average Power Limit).
+ * An EnergyStopwatch works the same way a regular stopwatch does, you can
+ * restart the stopwatch, start measuring energy by playing it, or stop
+ * measuring by pausing it.
+ *
+ * Domains are read from the power perf PMU
+ * (/sys/bus/event_source/devices/power), one counter per package. If the
+ * PMU is not available or perf is not allowed to use it (it requires
+ * perf_event_paranoid <= 0 or CAP_PERFMON), the powercap counters
+ * (/sys/class/powercap/intel-rapl:*) are used instead. powercap counters
+ * wrap around every max_energy_range_uj, a wraparound between play() and
+ * pause() is handled, but the stopwatch must be paused (or play()ed again)
+ * at least once per wraparound period (minutes under full load).
+ *
+ * Energy is measured for the whole packages, not only for the calling
+ * process.
+ *
+ * With -DHPCTOOLS_DISABLE_INSTRUMENTATION no counter is opened (source NONE),
+ * play() and pause() do nothing and every requested domain reads 0 J.
+ */
+
+class EnergyStopwatch {
+public:
+    enum Domain {
+        PACKAGE,
+        CORES,
+        DRAM,
+        PSYS, // Whole platform (SoC + memory + ...), if available.
+
+        NUM_DOMAINS
+    };
+
+    enum Source {
+        PERF,
+        POWERCAP,
+        NONE,
+    };
+
+    /**
+     * Initializes the stopwatch. Also performs a restart().
+     *
+     * Domains not provided by the CPU are not tracked (a warning is
+     * printed).
+     *
+     * @param req_domains_ Domains to measure.
+     */
+    EnergyStopwatch(const std::vector<Domain> &req_domains_ = {PACKAGE, CORES, DRAM});
+
+    EnergyStopwatch(const EnergyStopwatch &other) = delete;
+    EnergyStopwatch &operator=(const EnergyStopwatch &other) = delete;
+
+    /**
+     * Destroys the stopwatch.
+     *
+     */
+    ~EnergyStopwatch();
+
+    /**
+     * Restarts the stopwatch counters.
+     *
+     */
+    void restart();
+
+    /**
+     * Start measuring energy.
+     *
+     */
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+    void play();
+#else
+    void play() {}
+#endif
+
+    /**
+     * Stop measuring energy.
+     *
+     */
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+    void pause();
+#else
+    void pause() {}
+#endif
+
+    /**
+     * Print the joules and the average watts of every tracked domain into
+     * stdout.
+     *
+     */
+    void print_all_counters() const;
+
+    /**
+     * Get the joules consumed by DOMAIN.
+     *
+     * If the stopwatch is not tracking the target domain, the function
+     * will throw an exception.
+     *
+     * @param target_domain domain reference.
+     */
+    double get_joules(const Domain target_domain) const;
+
+    /**
+     * Get the average watts of DOMAIN.
+     *
+     * If the stopwatch is not tracking the target domain, the function
+     * will throw an exception.
+     *
+     * @param target_domain domain reference.
+     */
+    double get_watts(const Domain target_domain) const;
+
+    /**
+     * Get the seconds measured.
+     *
+     */
+    double get_s() const;
+
+    /**
+     * Get the energy-to-solution: package + DRAM joules (PSYS joules if
+     * neither of them is tracked).
+     *
+     */
+    double get_energy_to_solution() const;
+
+    /**
+     * Get the GFLOP/J given the floating point operations performed while
+     * the stopwatch was playing (e.g. PAPI_FP_OPS of PresetStopwatch).
+     *
+     * @param flops Floating point operations.
+     */
+    double get_gflops_per_joule(const uint64_t flops) const;
+
+    /**
+     * Get the source of the counters.
+     *
+     */
+    Source get_source() const;
+
+    /**
+     * Get the domain descriptor referred by DOMAIN.
+     *
+     * @param target_domain domain reference.
+     * @return const char* (domain descriptor).
+     */
+    static const char *get_descriptor(const Domain target_domain);
+
+private:
+    // A counter of a domain (one per package).
+    struct Counter {
+        int fd;              // perf fd or powercap energy_uj fd.
+        double scale;        // Joules per unit.
+        uint64_t max_range;  // Wraparound value (powercap only).
+        uint64_t start;      // Value on play time.
+    };
+
+    // Domain description.
+    static const char *descriptors[NUM_DOMAINS];
+
+    Source source;
+
+    std::vector<Domain> req_domains; // Domains being tracked.
+
+    std::vector<std::vector<Counter>> counters; // Counters of each requested domain.
+
+    std::vector<double> total_joules; // Total joules between plays and stops.
+
+    timespec start_time; // Last play timestamp.
+    double total_secs;   // Total seconds counted.
+
+    /**
+     * Open the counters of the requested domains using the power PMU.
+     *
+     * @return true if at least one domain could be opened, false otherwise.
+     */
+    bool open_perf();
+
+    /**
+     * Open the counters of the requested domains using powercap.
+     *
+     * @return true if at least one domain could be opened, false otherwise.
+     */
+    bool open_powercap();
+
+    /**
+     * Read the current value of a counter.
+     *
+     * @return true on success, false otherwise.
+     */
+    bool read_counter(const Counter &counter, uint64_t &value) const;
+
+    /**
+     * Close every counter.
+     *
+     */
+    void close_counters();
+};
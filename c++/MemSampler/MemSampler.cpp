@@ -0,0 +1,534 @@
+#define _GNU_SOURCE 1
+
+#include "MemSampler.h"
+
+#include "../SysFiles/SysFiles.h"
+
+#include "printer.h"
+
+#include <asm/unistd.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+// Data source description.
+const char *MemSampler::descriptors[NUM_SOURCES] = {
+    "L1",
+    "LFB",
+    "L2",
+    "L3",
+    "local RAM",
+    "remote cache",
+    "remote RAM",
+    "uncached",
+    "unknown",
+};
+
+/**
+ * Set the bits of a perf format ("config:0-7", "config1:0-15", ...) in the
+ * corresponding config field.
+ *
+ */
+static bool apply_format(const std::string &format, uint64_t value,
+                         uint64_t &config, uint64_t &config1) {
+    const size_t colon = format.find(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+
+    const std::string field = format.substr(0, colon);
+    uint64_t *target = nullptr;
+
+    if (field == "config") {
+        target = &config;
+    }
+    else if (field == "config1") {
+        target = &config1;
+    }
+    else {
+        return false;
+    }
+
+    // Ranges are separated by commas, the value bits are placed in order.
+    std::stringstream ranges(format.substr(colon + 1));
+    std::string range;
+
+    while (std::getline(ranges, range, ',')) {
+        int lo = 0;
+        int hi = 0;
+
+        if (sscanf(range.c_str(), "%d-%d", &lo, &hi) != 2) {
+            hi = lo;
+        }
+
+        for (int bit = lo; bit <= hi; ++bit) {
+            *target |= (value & 1) << bit;
+            value >>= 1;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Fill config and config1 from the terms of a PMU event ("event=0xcd,umask=0x1,
+ * ldlat=3"). The ldlat term, if any, is set to latency_threshold.
+ *
+ * @return true if every term has a known format, false otherwise.
+ */
+static bool parse_event(const std::string &pmu_path, const std::string &event,
+                        const uint64_t latency_threshold, uint64_t &config, uint64_t &config1) {
+    std::stringstream terms(event);
+    std::string term;
+
+    config = 0;
+    config1 = 0;
+
+    while (std::getline(terms, term, ',')) {
+        const size_t equal = term.find('=');
+        const std::string name = term.substr(0, equal);
+
+        uint64_t value = 1;
+        if (equal != std::string::npos) {
+            value = strtoull(term.c_str() + equal + 1, NULL, 0);
+        }
+
+        if (name == "ldlat") {
+            value = latency_threshold;
+        }
+
+        if (!apply_format(read_line(pmu_path + "/format/" + name), value, config, config1)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+MemSampler::MemSampler(const uint64_t latency_threshold_,
+                       const uint64_t sample_period_,
+                       const size_t buffer_pages_) :
+    latency_threshold(latency_threshold_),
+    sample_period(sample_period_),
+    buffer_pages(buffer_pages_),
+    type(0),
+    config(0),
+    config1(0),
+    aux(false),
+    aux_config(0),
+    aux_config1(0),
+    playing(false),
+    lost(0) {
+
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+    if (!find_event()) {
+        throw std::runtime_error("MemSampler: The CPU does not provide a load latency (mem-loads) event");
+    }
+#endif
+
+    // The last stats belong to the loads of non registered addresses.
+    object_names.push_back("[unknown]");
+    object_stats.emplace_back();
+
+    add_thread();
+
+    restart();
+}
+
+MemSampler::~MemSampler() {
+    for (auto &buffer : buffers) {
+        ioctl(buffer.aux_fd != -1 ? buffer.aux_fd : buffer.fd, PERF_EVENT_IOC_DISABLE, 0);
+        munmap(buffer.base, (buffer_pages + 1) * sysconf(_SC_PAGESIZE));
+        close(buffer.fd);
+
+        if (buffer.aux_fd != -1) {
+            close(buffer.aux_fd);
+        }
+    }
+}
+
+void MemSampler::add_thread() {
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+    struct perf_event_attr pe;
+
+    memset(&pe, 0, sizeof(struct perf_event_attr));
+    pe.size = sizeof(struct perf_event_attr);
+    pe.disabled = 1;
+
+    // Exclude kernel and hypervisor from being measured.
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+
+    pe.type = type;
+
+    int aux_fd = -1;
+
+    if (aux) {
+        // mem-loads must be in a group led by mem-loads-aux, which only counts.
+        pe.config = aux_config;
+        pe.config1 = aux_config1;
+
+        aux_fd = syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+
+        if (aux_fd == -1) {
+            print_error("Error opening mem-loads-aux event %llx %s\n",
+                        (unsigned long long)aux_config, strerror(errno));
+            return;
+        }
+
+        // Enabled and disabled with the leader.
+        pe.disabled = 0;
+    }
+
+    pe.config = config;
+    pe.config1 = config1;
+
+    pe.sample_period = sample_period;
+    pe.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_ADDR |
+                     PERF_SAMPLE_WEIGHT | PERF_SAMPLE_DATA_SRC;
+    pe.precise_ip = 2;
+
+    // Only the calling thread.
+    const int fd = syscall(__NR_perf_event_open, &pe, 0, -1, aux_fd, 0);
+
+    if (fd == -1) {
+        print_error("Error opening mem-loads event %llx %s\n",
+                    (unsigned long long)config, strerror(errno));
+
+        if (aux_fd != -1) {
+            close(aux_fd);
+        }
+        return;
+    }
+
+    const size_t length = (buffer_pages + 1) * sysconf(_SC_PAGESIZE);
+    void *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (base == MAP_FAILED) {
+        print_error("Error mapping the sample buffer %s\n", strerror(errno));
+        close(fd);
+
+        if (aux_fd != -1) {
+            close(aux_fd);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (playing) {
+        ioctl(aux_fd != -1 ? aux_fd : fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    buffers.push_back({fd, aux_fd, base});
+#endif
+}
+
+void MemSampler::register_object(const std::string &name, const void *addr, const size_t size) {
+    const uintptr_t start = reinterpret_cast<uintptr_t>(addr);
+
+    // pause() may be draining samples into the objects in another thread.
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Keep "[unknown]" as the last stats.
+    object_names.insert(object_names.end() - 1, name);
+    object_stats.insert(object_stats.end() - 1, Stats());
+
+    Object object = {start, start + size, object_stats.size() - 2};
+
+    objects.insert(std::upper_bound(objects.begin(), objects.end(), object,
+                                    [](const Object &a, const Object &b) {
+                                        return a.start < b.start;
+                                    }),
+                   object);
+}
+
+void MemSampler::restart() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto &stats : object_stats) {
+        stats = Stats();
+    }
+
+    ip_stats.clear();
+    lost = 0;
+}
+
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+void MemSampler::play() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Discard the samples taken while paused.
+    for (auto &buffer : buffers) {
+        auto *page = static_cast<struct perf_event_mmap_page *>(buffer.base);
+        page->data_tail = __atomic_load_n(&page->data_head, __ATOMIC_ACQUIRE);
+    }
+
+    for (const auto &buffer : buffers) {
+        ioctl(buffer.aux_fd != -1 ? buffer.aux_fd : buffer.fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    playing = true;
+}
+
+void MemSampler::pause() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (const auto &buffer : buffers) {
+        ioctl(buffer.aux_fd != -1 ? buffer.aux_fd : buffer.fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    for (auto &buffer : buffers) {
+        drain(buffer);
+    }
+
+    playing = false;
+}
+#endif
+
+void MemSampler::print_report(const size_t max_ips) const {
+    printf("%16s: %14lu\n", "lost samples", lost);
+
+    for (size_t i = 0; i < object_stats.size(); ++i) {
+        const auto &stats = object_stats[i];
+
+        if (stats.samples == 0) {
+            continue;
+        }
+
+        printf("\n%s\n", object_names[i].c_str());
+        printf("%16s: %14lu\n", "samples", stats.samples);
+        printf("%16s: %14.1lf\n", "avg latency", (double)stats.total_latency / stats.samples);
+        printf("%16s: %14lu\n", "HITM loads", stats.hitm);
+
+        for (int s = 0; s < NUM_SOURCES; ++s) {
+            if (stats.sources[s] != 0) {
+                printf("%16s: %14lu (%5.1lf%%)\n", descriptors[s], stats.sources[s],
+                       100.0 * stats.sources[s] / stats.samples);
+            }
+        }
+
+        for (int b = 0; b < NUM_BUCKETS; ++b) {
+            if (stats.histogram[b] == 0) {
+                continue;
+            }
+
+            char range[32];
+            if (b == NUM_BUCKETS - 1) {
+                snprintf(range, sizeof(range), ">= %lu cyc", 1UL << b);
+            }
+            else {
+                snprintf(range, sizeof(range), "%lu-%lu cyc", b == 0 ? 0 : 1UL << b, (1UL << (b + 1)) - 1);
+            }
+
+            printf("%16s: %14lu\n", range, stats.histogram[b]);
+        }
+    }
+
+    // IPs sorted by accumulated latency.
+    std::vector<std::pair<uint64_t, const Stats *>> ips;
+    for (const auto &ip : ip_stats) {
+        ips.emplace_back(ip.first, &ip.second);
+    }
+
+    std::sort(ips.begin(), ips.end(), [](const std::pair<uint64_t, const Stats *> &a,
+                                         const std::pair<uint64_t, const Stats *> &b) {
+        return a.second->total_latency > b.second->total_latency;
+    });
+
+    if (!ips.empty()) {
+        printf("\n%18s %10s %12s %10s  %s\n", "ip", "samples", "avg latency", "HITM", "symbol");
+    }
+
+    for (size_t i = 0; i < ips.size() && i < max_ips; ++i) {
+        const auto &stats = *ips[i].second;
+
+        Dl_info info;
+        const char *symbol = "??";
+        if (dladdr(reinterpret_cast<void *>(ips[i].first), &info) && info.dli_sname) {
+            symbol = info.dli_sname;
+        }
+
+        printf("%#18lx %10lu %12.1lf %10lu  %s\n", ips[i].first, stats.samples,
+               (double)stats.total_latency / stats.samples, stats.hitm, symbol);
+    }
+}
+
+const MemSampler::Stats &MemSampler::get_object_stats(const std::string &name) const {
+    for (size_t i = 0; i < object_names.size(); ++i) {
+        if (object_names[i] == name) {
+            return object_stats[i];
+        }
+    }
+
+    throw std::runtime_error("MemSampler: Trying to read a non registered object");
+}
+
+uint64_t MemSampler::get_lost() const {
+    return lost;
+}
+
+const char *MemSampler::get_descriptor(const DataSource source) {
+    return descriptors[source];
+}
+
+bool MemSampler::find_event() {
+    static const char *pmus[] = {"cpu", "cpu_core"};
+
+    for (const auto &pmu : pmus) {
+        const std::string path = std::string("/sys/bus/event_source/devices/") + pmu;
+        const std::string event = read_line(path + "/events/mem-loads");
+        const std::string pmu_type = read_line(path + "/type");
+
+        if (event.empty() || pmu_type.empty()) {
+            continue;
+        }
+
+        type = strtoul(pmu_type.c_str(), NULL, 10);
+
+        // e.g. "event=0xcd,umask=0x1,ldlat=3"
+        if (!parse_event(path, event, latency_threshold, config, config1)) {
+            return false;
+        }
+
+        if (event.find("ldlat") == std::string::npos) {
+            apply_format(read_line(path + "/format/ldlat"), latency_threshold, config, config1);
+        }
+
+        // Sapphire Rapids and the P-cores of hybrid CPUs require mem-loads
+        // to be led by mem-loads-aux.
+        const std::string aux_event = read_line(path + "/events/mem-loads-aux");
+
+        aux = !aux_event.empty() &&
+              parse_event(path, aux_event, latency_threshold, aux_config, aux_config1);
+
+        return true;
+    }
+
+    // Arm SPE and AMD IBS use their own PMUs and sample formats.
+    return false;
+}
+
+void MemSampler::drain(Buffer &buffer) {
+    auto *page = static_cast<struct perf_event_mmap_page *>(buffer.base);
+    const uint64_t size = buffer_pages * sysconf(_SC_PAGESIZE);
+    const uint8_t *data = static_cast<const uint8_t *>(buffer.base) + sysconf(_SC_PAGESIZE);
+
+    const uint64_t head = __atomic_load_n(&page->data_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = page->data_tail;
+
+    // Sample layout for IP | TID | ADDR | WEIGHT | DATA_SRC.
+    struct Sample {
+        struct perf_event_header header;
+        uint64_t ip;
+        uint32_t pid;
+        uint32_t tid;
+        uint64_t addr;
+        uint64_t weight;
+        uint64_t data_src;
+    };
+
+    while (tail < head) {
+        struct perf_event_header header;
+
+        // Records may wrap around the end of the buffer.
+        uint8_t record[sizeof(Sample)];
+        for (size_t i = 0; i < sizeof(header); ++i) {
+            record[i] = data[(tail + i) % size];
+        }
+        memcpy(&header, record, sizeof(header));
+
+        if (header.type == PERF_RECORD_SAMPLE && header.size >= sizeof(Sample)) {
+            for (size_t i = 0; i < sizeof(Sample); ++i) {
+                record[i] = data[(tail + i) % size];
+            }
+
+            Sample sample;
+            memcpy(&sample, record, sizeof(Sample));
+
+            account(sample.ip, sample.addr, sample.weight, sample.data_src);
+        }
+        else if (header.type == PERF_RECORD_LOST) {
+            uint64_t lost_record[3]; // header, id, lost
+            for (size_t i = 0; i < sizeof(lost_record); ++i) {
+                reinterpret_cast<uint8_t *>(lost_record)[i] = data[(tail + i) % size];
+            }
+
+            lost += lost_record[2];
+        }
+
+        tail += header.size;
+    }
+
+    __atomic_store_n(&page->data_tail, tail, __ATOMIC_RELEASE);
+}
+
+void MemSampler::account(const uint64_t ip, const uint64_t addr, const uint64_t weight,
+                         const uint64_t data_src) {
+    // Find the object.
+    size_t stats_index = object_stats.size() - 1;
+
+    auto it = std::upper_bound(objects.begin(), objects.end(), addr,
+                               [](const uintptr_t a, const Object &object) {
+                                   return a < object.start;
+                               });
+
+    if (it != objects.begin() && addr < (it - 1)->end) {
+        stats_index = (it - 1)->stats;
+    }
+
+    // Decode the data source.
+    union perf_mem_data_src src;
+    src.val = data_src;
+
+    DataSource source = SRC_UNKNOWN;
+
+    if (src.mem_lvl & PERF_MEM_LVL_L1) {
+        source = SRC_L1;
+    }
+    else if (src.mem_lvl & PERF_MEM_LVL_LFB) {
+        source = SRC_LFB;
+    }
+    else if (src.mem_lvl & PERF_MEM_LVL_L2) {
+        source = SRC_L2;
+    }
+    else if (src.mem_lvl & PERF_MEM_LVL_L3) {
+        source = SRC_L3;
+    }
+    else if (src.mem_lvl & PERF_MEM_LVL_LOC_RAM) {
+        source = SRC_LOCAL_RAM;
+    }
+    else if (src.mem_lvl & (PERF_MEM_LVL_REM_CCE1 | PERF_MEM_LVL_REM_CCE2)) {
+        source = SRC_REMOTE_CACHE;
+    }
+    else if (src.mem_lvl & (PERF_MEM_LVL_REM_RAM1 | PERF_MEM_LVL_REM_RAM2)) {
+        source = SRC_REMOTE_RAM;
+    }
+    else if (src.mem_lvl & (PERF_MEM_LVL_IO | PERF_MEM_LVL_UNC)) {
+        source = SRC_UNCACHED;
+    }
+
+    const bool hitm = src.mem_snoop & PERF_MEM_SNOOP_HITM;
+
+    int bucket = 0;
+    while (bucket < NUM_BUCKETS - 1 && (weight >> (bucket + 1)) != 0) {
+        ++bucket;
+    }
+
+    for (Stats *stats : {&object_stats[stats_index], &ip_stats[ip]}) {
+        stats->samples += 1;
+        stats->total_latency += weight;
+        stats->hitm += hitm;
+        stats->sources[source] += 1;
+        stats->histogram[bucket] += 1;
+    }
+}
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @author Lorién López Villellas (lorien.lopez@bsc.es)
+ *
+ * A module for sampling memory loads using precise perf events (PEBS load
+ * latency on Intel). Every sample carries the instruction pointer, the data
+ * address, the latency and the data source of a load whose latency is over a
+ * threshold.
+ *
+ * On CPUs that need it (Sapphire Rapids, the P-cores of hybrid Intel CPUs),
+ * the mem-loads event is opened in a group led by the mem-loads-aux event.
+ *
+ * Samples are attributed to data objects registered by the user (address
+ * ranges such as "grid_u" or "halo_buffer") and to the instruction that
+ * issued the load. The report shows a latency histogram and a data source
+ * breakdown (L1/LFB/L2/L3/local DRAM/remote cache/remote DRAM) for every
+ * object, and the IPs with the highest accumulated latency.
+ * Loads that hit a modified line in another core (HITM) are reported too, a
+ * high number of HITM loads on an object is a sign of false sharing.
+ *
+ * A MemSampler works the same way a stopwatch does, you can restart the
+ * sampler, start sampling by playing it, or stop sampling by pausing it.
+ * With -DHPCTOOLS_DISABLE_INSTRUMENTATION the load latency event is not
+ * looked up, no thread is sampled and play() and pause() do nothing.
+ *
+ * Warning: Samples are taken per thread. Every thread to sample, besides
+ * the one that builds the sampler, must call add_thread() once.
+ */
+
+class MemSampler {
+public:
+    enum DataSource {
+        SRC_L1,
+        SRC_LFB,
+        SRC_L2,
+        SRC_L3,
+        SRC_LOCAL_RAM,
+        SRC_REMOTE_CACHE,
+        SRC_REMOTE_RAM,
+        SRC_UNCACHED,
+        SRC_UNKNOWN,
+
+        NUM_SOURCES
+    };
+
+    // Latency histogram buckets, bucket i > 0 holds latencies in [2^i, 2^(i+1)).
+    static const int NUM_BUCKETS = 16;
+
+    // Statistics of the samples attributed to a data object or to an IP.
+    struct Stats {
+        uint64_t samples = 0;
+        uint64_t total_latency = 0;
+        uint64_t hitm = 0;
+        uint64_t sources[NUM_SOURCES] = {0};
+        uint64_t histogram[NUM_BUCKETS] = {0};
+    };
+
+    /**
+     * Initializes the sampler and adds the calling thread. Also performs
+     * a restart().
+     *
+     * If the CPU does not provide a load latency event, the constructor will
+     * throw an exception.
+     *
+     * @param latency_threshold_ Minimum latency (in cycles) of a sampled load.
+     * @param sample_period_ Sample one of every sample_period_ loads over the
+     *                       threshold.
+     * @param buffer_pages_ Pages of the sample buffer of every thread
+     *                      (power of 2).
+     */
+    MemSampler(const uint64_t latency_threshold_ = 30,
+               const uint64_t sample_period_ = 1000,
+               const size_t buffer_pages_ = 64);
+
+    MemSampler(const MemSampler &other) = delete;
+    MemSampler &operator=(const MemSampler &other) = delete;
+
+    /**
+     * Destroys the sampler.
+     *
+     */
+    ~MemSampler();
+
+    /**
+     * Start sampling the loads of the calling thread.
+     *
+     */
+    void add_thread();
+
+    /**
+     * Register a data object. Samples whose data address is inside
+     * [addr, addr + size) are attributed to the object.
+     *
+     * @param name Name of the object.
+     * @param addr Start address of the object.
+     * @param size Size of the object in bytes.
+     */
+    void register_object(const std::string &name, const void *addr, const size_t size);
+
+    /**
+     * Discard every sample.
+     *
+     */
+    void restart();
+
+    /**
+     * Start sampling.
+     *
+     */
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+    void play();
+#else
+    void play() {}
+#endif
+
+    /**
+     * Stop sampling and process the samples taken.
+     *
+     */
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+    void pause();
+#else
+    void pause() {}
+#endif
+
+    /**
+     * Print the per-object and per-IP report into stdout.
+     *
+     * @param max_ips Maximum number of IPs to print.
+     */
+    void print_report(const size_t max_ips = 10) const;
+
+    /**
+     * Get the statistics of a registered object. Samples that do not belong
+     * to any object are attributed to "[unknown]".
+     *
+     * If the object is not registered, the function will throw an exception.
+     *
+     * @param name Name of the object.
+     */
+    const Stats &get_object_stats(const std::string &name) const;
+
+    /**
+     * Get the number of samples lost because a sample buffer was full.
+     *
+     */
+    uint64_t get_lost() const;
+
+    /**
+     * Get the descriptor of a data source.
+     *
+     * @param source data source reference.
+     * @return const char* (data source descriptor).
+     */
+    static const char *get_descriptor(const DataSource source);
+
+private:
+    // A registered data object.
+    struct Object {
+        uintptr_t start;
+        uintptr_t end;
+        size_t stats; // Index in object_stats.
+    };
+
+    // The sample buffer of a thread.
+    struct Buffer {
+        int fd;
+        int aux_fd; // mem-loads-aux group leader, -1 if not needed.
+        void *base; // perf_event_mmap_page followed by the data pages.
+    };
+
+    // Data source description.
+    static const char *descriptors[NUM_SOURCES];
+
+    uint64_t latency_threshold;
+    uint64_t sample_period;
+    size_t buffer_pages;
+
+    // PMU type and configuration of the load latency event.
+    uint32_t type;
+    uint64_t config;
+    uint64_t config1;
+
+    // Configuration of the mem-loads-aux event that must lead mem-loads.
+    bool aux;
+    uint64_t aux_config;
+    uint64_t aux_config1;
+
+    bool playing;
+
+    mutable std::mutex mutex; // Protects buffers, objects and stats.
+    std::vector<Buffer> buffers;
+
+    std::vector<Object> objects; // Sorted by start address.
+    std::vector<std::string> object_names;
+    std::vector<Stats> object_stats; // Last one is "[unknown]".
+
+    std::map<uint64_t, Stats> ip_stats;
+
+    uint64_t lost;
+
+    /**
+     * Find the load latency event of the CPU (the mem-loads alias of the core
+     * PMU) and fill type, config and config1. Also fill aux, aux_config and
+     * aux_config1 if the PMU provides the mem-loads-aux event.
+     *
+     * @return true if the event exists, false otherwise.
+     */
+    bool find_event();
+
+    /**
+     * Process the samples of a buffer.
+     *
+     * @param buffer Buffer to drain.
+     */
+    void drain(Buffer &buffer);
+
+    /**
+     * Account a sample.
+     *
+     */
+    void account(const uint64_t ip, const uint64_t addr, const uint64_t weight,
+                 const uint64_t data_src);
+};
@@ -0,0 +1,144 @@
+#define _GNU_SOURCE 1
+
+#include "MetricRegistry.h"
+
+#include "printer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <mutex>
+
+MetricRegistry::Header *MetricRegistry::header = nullptr;
+MetricRegistry::Slot *MetricRegistry::slots = nullptr;
+
+// Protects the registration of metrics.
+static std::mutex mutex;
+
+// The segment has been removed by stop().
+static bool stopped = false;
+
+/**
+ * Copy a string into a fixed-size buffer, truncating it if necessary.
+ *
+ */
+static void copy_name(char *dst, const std::string &src, const size_t size) {
+    strncpy(dst, src.c_str(), size - 1);
+    dst[size - 1] = '\0';
+}
+
+/**
+ * Remove the segment at exit.
+ *
+ */
+static void remove_segment() {
+    MetricRegistry::stop();
+}
+
+/**
+ * Create the segment. mutex must be held.
+ *
+ */
+static bool create_segment(const uint32_t max_slots, MetricRegistry::Header *&header,
+                           MetricRegistry::Slot *&slots) {
+    const std::string name = MetricRegistry::segment_name(getpid());
+    const size_t size = sizeof(MetricRegistry::Header) + max_slots * sizeof(MetricRegistry::Slot);
+
+    const int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+
+    if (fd == -1) {
+        print_error("MetricRegistry: Error creating %s %s\n", name.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (ftruncate(fd, size) != 0) {
+        print_error("MetricRegistry: Error resizing %s %s\n", name.c_str(), strerror(errno));
+        close(fd);
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED) {
+        print_error("MetricRegistry: Error mapping %s %s\n", name.c_str(), strerror(errno));
+        shm_unlink(name.c_str());
+        return false;
+    }
+
+    // ftruncate zero-fills the segment.
+    header = reinterpret_cast<MetricRegistry::Header *>(addr);
+    slots = reinterpret_cast<MetricRegistry::Slot *>(header + 1);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    memcpy(header->magic, "HPCMETRC", sizeof(header->magic));
+    header->version = MetricRegistry::VERSION;
+    header->slot_size = sizeof(MetricRegistry::Slot);
+    header->max_slots = max_slots;
+    header->pid = getpid();
+    header->start_ns = ts.tv_sec * 1000000000UL + ts.tv_nsec;
+    header->num_slots.store(0, std::memory_order_release);
+
+    return true;
+}
+
+void MetricRegistry::start(const uint32_t max_slots) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (header != nullptr) {
+        return;
+    }
+
+    if (create_segment(max_slots, header, slots)) {
+        stopped = false;
+        atexit(remove_segment);
+    }
+}
+
+void MetricRegistry::stop() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (header != nullptr && !stopped) {
+        shm_unlink(segment_name(getpid()).c_str());
+        stopped = true;
+    }
+}
+
+uint32_t MetricRegistry::register_metric(const std::string &name,
+                                         const std::vector<std::string> &value_names) {
+    start();
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (header == nullptr) {
+        return NO_SLOT;
+    }
+
+    const uint32_t slot = header->num_slots.load(std::memory_order_relaxed);
+
+    if (slot == header->max_slots) {
+        print_error("MetricRegistry: No free slot for %s\n", name.c_str());
+        return NO_SLOT;
+    }
+
+    Slot &s = slots[slot];
+
+    copy_name(s.name, name, NAME_LEN);
+
+    s.num_values = value_names.size() < MAX_VALUES ? value_names.size() : MAX_VALUES;
+    for (uint32_t i = 0; i < s.num_values; ++i) {
+        copy_name(s.value_names[i], value_names[i], VALUE_NAME_LEN);
+    }
+
+    // Make the slot visible to the readers.
+    header->num_slots.store(slot + 1, std::memory_order_release);
+
+    return slot;
+}
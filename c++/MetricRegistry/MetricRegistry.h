@@ -0,0 +1,160 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+/**
+ * @author Lorién López Villellas (lorien.lopez@bsc.es)
+ *
+ * A module for publishing live metrics into a POSIX shared memory segment
+ * ("/hpctools.<pid>"), so a running program can be monitored from another
+ * process with hpcmon.
+ *
+ * Every metric (a region) owns a slot of the segment holding its name and
+ * up to MAX_VALUES cumulative values. Slots are protected by a seqlock: the
+ * writer never blocks and never makes a syscall, readers retry while a slot
+ * is being updated.
+ *
+ * TimeStopwatch and PerfStopwatch publish their totals on every pause()
+ * after calling their publish() method.
+ *
+ * Warning: A slot must have a single writer (the thread controlling the
+ * stopwatch).
+ */
+
+class MetricRegistry {
+public:
+    // Version of the segment layout.
+    static const uint32_t VERSION = 1;
+
+    // Max. values of a slot.
+    static const int MAX_VALUES = 8;
+
+    // Max. length of the names (including '\0').
+    static const int NAME_LEN = 48;
+    static const int VALUE_NAME_LEN = 24;
+
+    // Slot ID of the unpublished metrics.
+    static const uint32_t NO_SLOT = UINT32_MAX;
+
+    // A metric. sequence is odd while the values are being updated.
+    struct Slot {
+        std::atomic<uint64_t> sequence;
+        char name[NAME_LEN];
+        uint32_t num_values;
+        uint32_t reserved;
+        char value_names[MAX_VALUES][VALUE_NAME_LEN];
+        std::atomic<uint64_t> values[MAX_VALUES];
+    };
+
+    // Header of the segment, followed by max_slots slots.
+    struct Header {
+        char magic[8]; // "HPCMETRC"
+        uint32_t version;
+        uint32_t slot_size;
+        uint32_t max_slots;
+        uint32_t pid;
+        uint64_t start_ns;               // CLOCK_MONOTONIC at start().
+        std::atomic<uint32_t> num_slots; // Slots in use.
+        uint32_t reserved;
+    };
+
+    MetricRegistry() = delete; // Static class.
+
+    /**
+     * Create the shared memory segment. Called by register_metric() if it
+     * has not been called before.
+     *
+     * @param max_slots Max. number of metrics.
+     */
+    static void start(const uint32_t max_slots = 256);
+
+    /**
+     * Remove the shared memory segment. The segment stays mapped so that
+     * publish() remains safe, but no reader can attach anymore.
+     *
+     */
+    static void stop();
+
+    /**
+     * Register a metric.
+     *
+     * @param name Name of the metric.
+     * @param value_names Names of the values of the metric (up to MAX_VALUES).
+     * @return uint32_t slot ID, NO_SLOT if the segment is full or could not
+     *         be created.
+     */
+    static uint32_t register_metric(const std::string &name,
+                                    const std::vector<std::string> &value_names);
+
+    /**
+     * Publish the values of a metric.
+     *
+     * @param slot Slot ID.
+     * @param values Values of the metric.
+     * @param num_values Number of values (up to the registered ones).
+     */
+    static inline void publish(const uint32_t slot, const uint64_t *values,
+                               const int num_values) {
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+        if (slot == NO_SLOT || slots == nullptr) {
+            return;
+        }
+
+        Slot &s = slots[slot];
+
+        const uint64_t seq = s.sequence.load(std::memory_order_relaxed);
+
+        s.sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (int i = 0; i < num_values && i < (int)s.num_values; ++i) {
+            s.values[i].store(values[i], std::memory_order_relaxed);
+        }
+
+        s.sequence.store(seq + 2, std::memory_order_release);
+#else
+        (void)slot;
+        (void)values;
+        (void)num_values;
+#endif
+    }
+
+    /**
+     * Read a consistent copy of the values of a slot (reader side).
+     *
+     * @param slot Slot to read.
+     * @param values Output values (MAX_VALUES).
+     * @return false if the slot is being updated, true otherwise.
+     */
+    static inline bool read_slot(const Slot &slot, uint64_t *values) {
+        const uint64_t seq = slot.sequence.load(std::memory_order_acquire);
+
+        if (seq & 1) {
+            return false;
+        }
+
+        for (int i = 0; i < MAX_VALUES; ++i) {
+            values[i] = slot.values[i].load(std::memory_order_relaxed);
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        return slot.sequence.load(std::memory_order_relaxed) == seq;
+    }
+
+    /**
+     * Name of the segment of a process.
+     *
+     */
+    static inline std::string segment_name(const int pid) {
+        return "/hpctools." + std::to_string(pid);
+    }
+
+private:
+    static Header *header;
+    static Slot *slots;
+};
@@ -0,0 +1,242 @@
+/**
+ * @author Lorién López Villellas (lorien.lopez@bsc.es)
+ *
+ * Show the metrics published by a running process through MetricRegistry.
+ * Every interval, print the rate of every value of every region:
+ *
+ *    - Values whose name ends in " ns" (e.g. TimeStopwatch's "time ns") and
+ *      the task/cpu clock of PerfStopwatch are shown as the share of the
+ *      wall time spent in the region.
+ *    - Values whose name contains "bytes" are shown in GB/s.
+ *    - LL misses are also shown as an estimation of the memory bandwidth
+ *      (one cache line per miss).
+ *    - Anything else (instructions, cycles...) is shown in events/s.
+ *
+ * A slot that is still being updated after many retries (e.g. the process
+ * died in the middle of an update) is shown as stale.
+ *
+ * Usage: hpcmon PID [interval (s)] [iterations (0 = until the process ends)]
+ */
+
+#include "MetricRegistry.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+// Bytes per LL miss.
+static const double CACHE_LINE_SIZE = 64;
+
+// Reads of a slot before giving up on it.
+static const int MAX_READ_RETRIES = 10000;
+
+// A copy of the values of every slot.
+struct Snapshot {
+    uint64_t ns;
+    std::vector<uint64_t> values; // MAX_VALUES per slot.
+    std::vector<bool> stale;      // The slot could not be read.
+};
+
+/**
+ * Get the current time in nanoseconds.
+ *
+ */
+static uint64_t get_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/**
+ * Check if a string ends with a suffix.
+ *
+ */
+static bool ends_with(const std::string &str, const std::string &suffix) {
+    return str.size() >= suffix.size() &&
+           str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/**
+ * Print a rate with an SI prefix.
+ *
+ */
+static void print_rate(const double rate, const char *unit) {
+    static const char *prefixes[] = {"", "K", "M", "G", "T", "P"};
+
+    double value = rate;
+    size_t p = 0;
+
+    while (value >= 1000 && p < sizeof(prefixes) / sizeof(prefixes[0]) - 1) {
+        value /= 1000;
+        ++p;
+    }
+
+    printf("%10.2lf %s%s", value, prefixes[p], unit);
+}
+
+/**
+ * Copy the values of the first num_slots slots. The values of a stale slot
+ * are taken from PREV (0 if the slot is new).
+ *
+ */
+static void take_snapshot(const MetricRegistry::Slot *slots, const uint32_t num_slots,
+                          const Snapshot &prev, Snapshot &snapshot) {
+    snapshot.values.resize(num_slots * MetricRegistry::MAX_VALUES);
+    snapshot.stale.assign(num_slots, false);
+
+    for (uint32_t s = 0; s < num_slots; ++s) {
+        uint64_t *values = &snapshot.values[s * MetricRegistry::MAX_VALUES];
+        int retries = 0;
+
+        // Retry while the writer is updating the slot.
+        while (!MetricRegistry::read_slot(slots[s], values)) {
+            if (++retries == MAX_READ_RETRIES) {
+                snapshot.stale[s] = true;
+                break;
+            }
+        }
+
+        if (snapshot.stale[s]) {
+            for (int v = 0; v < MetricRegistry::MAX_VALUES; ++v) {
+                const size_t i = s * MetricRegistry::MAX_VALUES + v;
+                values[v] = i < prev.values.size() ? prev.values[i] : 0;
+            }
+        }
+    }
+
+    snapshot.ns = get_ns();
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s PID [interval (s)] [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    const int pid = atoi(argv[1]);
+    const double interval = argc > 2 ? atof(argv[2]) : 1.0;
+    const long iterations = argc > 3 ? atol(argv[3]) : 0;
+
+    const std::string name = MetricRegistry::segment_name(pid);
+
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd == -1) {
+        fprintf(stderr, "Error opening %s: %s\n", name.c_str(), strerror(errno));
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(MetricRegistry::Header)) {
+        fprintf(stderr, "%s is not a metric segment\n", name.c_str());
+        return 1;
+    }
+
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (addr == MAP_FAILED) {
+        fprintf(stderr, "Error mapping %s: %s\n", name.c_str(), strerror(errno));
+        return 1;
+    }
+
+    const auto *header = reinterpret_cast<const MetricRegistry::Header *>(addr);
+    const auto *slots = reinterpret_cast<const MetricRegistry::Slot *>(header + 1);
+
+    if (memcmp(header->magic, "HPCMETRC", sizeof(header->magic)) != 0 ||
+        header->version != MetricRegistry::VERSION ||
+        header->slot_size != sizeof(MetricRegistry::Slot) ||
+        sizeof(MetricRegistry::Header) + header->max_slots * sizeof(MetricRegistry::Slot) >
+            (size_t)st.st_size) {
+        fprintf(stderr, "Unsupported metric segment version %u\n", header->version);
+        return 1;
+    }
+
+    const bool interactive = isatty(STDOUT_FILENO);
+
+    Snapshot prev;
+    take_snapshot(slots, header->num_slots.load(std::memory_order_acquire), Snapshot(), prev);
+
+    for (long it = 0; iterations == 0 || it < iterations; ++it) {
+        usleep(interval * 1e6);
+
+        if (kill(pid, 0) != 0 && errno == ESRCH) {
+            printf("Process %d has finished\n", pid);
+            break;
+        }
+
+        const uint32_t num_slots = header->num_slots.load(std::memory_order_acquire);
+
+        Snapshot curr;
+        take_snapshot(slots, num_slots, prev, curr);
+
+        const double secs = (curr.ns - prev.ns) / 1e9;
+
+        if (interactive) {
+            // Clear the screen.
+            printf("\033[H\033[2J");
+        }
+
+        printf("PID %d, %u regions, %.2lf s since start\n\n", pid, num_slots,
+               (curr.ns - header->start_ns) / 1e9);
+        printf("%-24s %-24s %20s %16s\n", "region", "value", "total", "rate");
+
+        for (uint32_t s = 0; s < num_slots; ++s) {
+            const auto &slot = slots[s];
+
+            for (uint32_t v = 0; v < slot.num_values && v < MetricRegistry::MAX_VALUES; ++v) {
+                const size_t i = s * MetricRegistry::MAX_VALUES + v;
+
+                // Slots registered during the interval start at 0.
+                const uint64_t before = i < prev.values.size() ? prev.values[i] : 0;
+                // The stopwatch has been restarted.
+                const uint64_t delta = curr.values[i] >= before ? curr.values[i] - before
+                                                                : curr.values[i];
+                const double rate = secs > 0 ? delta / secs : 0;
+
+                const std::string value_name(slot.value_names[v]);
+
+                printf("%-24.24s %-24.24s %20lu ", v == 0 ? slot.name : "", value_name.c_str(),
+                       curr.values[i]);
+
+                if (curr.stale[s]) {
+                    printf("%16s", "stale");
+                }
+                else if (ends_with(value_name, " ns") || value_name == "task clock" ||
+                         value_name == "cpu clock") {
+                    printf("%11.2lf %% time", rate / 1e7);
+                }
+                else if (value_name.find("bytes") != std::string::npos) {
+                    printf("%10.2lf GB/s", rate / 1e9);
+                }
+                else if (value_name.find("LL") == 0 && value_name.find("misses") != std::string::npos) {
+                    print_rate(rate, "/s");
+                    printf(" (%.2lf GB/s)", rate * CACHE_LINE_SIZE / 1e9);
+                }
+                else {
+                    print_rate(rate, "/s");
+                }
+
+                printf("\n");
+            }
+        }
+
+        fflush(stdout);
+
+        prev = curr;
+    }
+
+    munmap(addr, st.st_size);
+
+    return 0;
+}
@@ -0,0 +1,415 @@
+#define _GNU_SOURCE 1
+
+#include "NumaReport.h"
+
+#include "../SysFiles/SysFiles.h"
+
+#include "printer.h"
+
+#include <asm/unistd.h>
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+// Counter description.
+const char *NumaReport::descriptors[NUM_COUNTERS] = {
+    "NODE read access",
+    "NODE read misses",
+    "cpu migrations",
+};
+
+/**
+ * NODE read access counts every DRAM access, NODE read misses the remote ones.
+ *
+ */
+static uint64_t local_accesses(const uint64_t access, const uint64_t misses) {
+    return access > misses ? access - misses : 0;
+}
+
+NumaReport::NumaReport() :
+    num_nodes(1),
+    start_migrated(0),
+    total_migrated(0) {
+
+    // CPU -> node mapping.
+    const auto nodes = parse_list(read_line("/sys/devices/system/node/possible"));
+
+    for (const auto &node : nodes) {
+        num_nodes = std::max(num_nodes, node + 1);
+
+        const std::string cpulist = read_line("/sys/devices/system/node/node" +
+                                              std::to_string(node) + "/cpulist");
+
+        for (const auto &cpu : parse_list(cpulist)) {
+            if (cpu >= (int)cpu_node.size()) {
+                cpu_node.resize(cpu + 1, -1);
+            }
+            cpu_node[cpu] = node;
+        }
+    }
+
+    // Kernel without NUMA support, every CPU is in node 0.
+    if (nodes.empty()) {
+        cpu_node.assign(sysconf(_SC_NPROCESSORS_CONF), 0);
+    }
+
+    add_thread();
+
+    restart();
+}
+
+NumaReport::~NumaReport() {
+    for (const auto &thread : threads) {
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            if (thread.fd[c] != -1) {
+                ioctl(thread.fd[c], PERF_EVENT_IOC_DISABLE, 0);
+                close(thread.fd[c]);
+            }
+        }
+    }
+}
+
+void NumaReport::add_thread() {
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+    static const uint32_t types[NUM_COUNTERS] = {
+        PERF_TYPE_HW_CACHE,
+        PERF_TYPE_HW_CACHE,
+        PERF_TYPE_SOFTWARE,
+    };
+
+    static const uint64_t configs[NUM_COUNTERS] = {
+        // NODE Read access
+        PERF_COUNT_HW_CACHE_NODE |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16),
+
+        // NODE Read misses
+        PERF_COUNT_HW_CACHE_NODE |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+
+        PERF_COUNT_SW_CPU_MIGRATIONS,
+    };
+#endif
+
+    Thread thread;
+    thread.tid = syscall(__NR_gettid);
+    thread.node = get_thread_node(thread.tid);
+    thread.node_changed = false;
+
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+        struct perf_event_attr pe;
+
+        memset(&pe, 0, sizeof(struct perf_event_attr));
+        pe.size = sizeof(struct perf_event_attr);
+
+        pe.type = types[c];
+        pe.config = configs[c];
+
+        // Exclude kernel and hypervisor from being measured. Software
+        // events (CPU migrations) only happen in the kernel.
+        pe.exclude_kernel = pe.type != PERF_TYPE_SOFTWARE;
+        pe.exclude_hv = 1;
+
+        // Only the calling thread, always enabled.
+        thread.fd[c] = syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+
+        // perf_event_paranoid may not allow counting in the kernel.
+        if (thread.fd[c] == -1 && !pe.exclude_kernel && (errno == EACCES || errno == EPERM)) {
+            pe.exclude_kernel = 1;
+            thread.fd[c] = syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+        }
+
+        if (thread.fd[c] == -1) {
+            print_error("Error opening event %llx (%s) %s\n",
+                        pe.config, descriptors[c], strerror(errno));
+        }
+#else
+        thread.fd[c] = -1;
+#endif
+
+        thread.start_count[c] = 0;
+        thread.total_count[c] = 0;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    threads.push_back(thread);
+}
+
+void NumaReport::register_buffer(const std::string &name, const void *addr, const size_t size) {
+    Buffer buffer;
+    buffer.name = name;
+    buffer.start = reinterpret_cast<uintptr_t>(addr);
+    buffer.size = size;
+    buffer.policy = MPOL_DEFAULT;
+    buffer.pages.resize(num_nodes, 0);
+    buffer.not_present = 0;
+
+    buffers.push_back(buffer);
+}
+
+void NumaReport::restart() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto &thread : threads) {
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            thread.total_count[c] = 0;
+        }
+        thread.node_changed = false;
+    }
+
+    total_migrated = 0;
+}
+
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+void NumaReport::play() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto &thread : threads) {
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            if (thread.fd[c] == -1) {
+                continue;
+            }
+
+            if (sizeof(uint64_t) != read(thread.fd[c], &thread.start_count[c], sizeof(uint64_t))) {
+                print_error("%16s: ERROR reading perf event.\n", descriptors[c]);
+            }
+        }
+
+        thread.node = get_thread_node(thread.tid);
+    }
+
+    start_migrated = read_migrated_pages();
+}
+
+void NumaReport::pause() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto &thread : threads) {
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            if (thread.fd[c] == -1) {
+                continue;
+            }
+
+            uint64_t stop_count;
+
+            if (sizeof(uint64_t) != read(thread.fd[c], &stop_count, sizeof(uint64_t))) {
+                print_error("%16s: ERROR reading perf event.\n", descriptors[c]);
+            }
+            else {
+                thread.total_count[c] += (stop_count - thread.start_count[c]);
+            }
+        }
+
+        const int node = get_thread_node(thread.tid);
+        thread.node_changed = thread.node_changed || node != thread.node;
+        thread.node = node;
+    }
+
+    total_migrated += read_migrated_pages() - start_migrated;
+
+    for (auto &buffer : buffers) {
+        query_pages(buffer);
+    }
+}
+#endif
+
+void NumaReport::print_report() const {
+    static const char *policies[] = {
+        "default", "preferred", "bind", "interleave", "local",
+    };
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    printf("Threads\n");
+    for (const auto &thread : threads) {
+        printf("%16d: node %2d%s, %lu cpu migrations\n", thread.tid, thread.node,
+               thread.node_changed ? " (has changed)" : "",
+               thread.total_count[CPU_MIGRATIONS]);
+    }
+
+    printf("\nDRAM accesses\n");
+    for (int node = 0; node < num_nodes; ++node) {
+        uint64_t local = 0;
+        uint64_t remote = 0;
+
+        for (const auto &thread : threads) {
+            if (thread.node == node) {
+                remote += thread.total_count[NODE_MISSES];
+                local += local_accesses(thread.total_count[NODE_ACCESS], thread.total_count[NODE_MISSES]);
+            }
+        }
+
+        const uint64_t total = local + remote;
+        printf("%14s %d: %14lu local %14lu remote (%5.1lf%% remote)\n", "node", node, local,
+               remote, total == 0 ? 0.0 : 100.0 * remote / total);
+    }
+
+    printf("\nPages\n");
+    for (const auto &buffer : buffers) {
+        const char *policy = "unknown";
+        if (buffer.policy >= 0 && buffer.policy < (int)(sizeof(policies) / sizeof(policies[0]))) {
+            policy = policies[buffer.policy];
+        }
+
+        printf("%16s: policy %s\n", buffer.name.c_str(), policy);
+
+        for (int node = 0; node < num_nodes; ++node) {
+            printf("%14s %d: %14lu\n", "node", node, buffer.pages[node]);
+        }
+        printf("%16s: %14lu\n", "not present", buffer.not_present);
+    }
+
+    printf("\n%16s: %14lu\n", "migrated pages", total_migrated);
+}
+
+int NumaReport::get_num_nodes() const {
+    return num_nodes;
+}
+
+uint64_t NumaReport::get_local_accesses(const int node) const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint64_t local = 0;
+    for (const auto &thread : threads) {
+        if (thread.node == node) {
+            local += local_accesses(thread.total_count[NODE_ACCESS], thread.total_count[NODE_MISSES]);
+        }
+    }
+
+    return local;
+}
+
+uint64_t NumaReport::get_remote_accesses(const int node) const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint64_t remote = 0;
+    for (const auto &thread : threads) {
+        if (thread.node == node) {
+            remote += thread.total_count[NODE_MISSES];
+        }
+    }
+
+    return remote;
+}
+
+uint64_t NumaReport::get_pages(const std::string &name, const int node) const {
+    for (const auto &buffer : buffers) {
+        if (buffer.name == name) {
+            if (node < 0 || (size_t)node >= buffer.pages.size()) {
+                throw std::runtime_error("NumaReport: Trying to read a non existing node");
+            }
+
+            return buffer.pages[node];
+        }
+    }
+
+    throw std::runtime_error("NumaReport: Trying to read a non registered buffer");
+}
+
+uint64_t NumaReport::get_migrated_pages() const {
+    return total_migrated;
+}
+
+int NumaReport::get_thread_node(const pid_t tid) const {
+    // The processor is the 39th field of the stat file.
+    std::ifstream stat("/proc/self/task/" + std::to_string(tid) + "/stat");
+    std::string line;
+
+    if (!std::getline(stat, line)) {
+        return -1;
+    }
+
+    // The command may contain spaces, skip it.
+    const size_t end_comm = line.rfind(')');
+    if (end_comm == std::string::npos) {
+        return -1;
+    }
+
+    std::stringstream fields(line.substr(end_comm + 2));
+    std::string field;
+    int cpu = -1;
+
+    // Fields after the command start at 3.
+    for (int i = 3; i <= 39 && fields >> field; ++i) {
+        if (i == 39) {
+            cpu = atoi(field.c_str());
+        }
+    }
+
+    if (cpu < 0 || cpu >= (int)cpu_node.size()) {
+        return -1;
+    }
+
+    return cpu_node[cpu];
+}
+
+uint64_t NumaReport::read_migrated_pages() {
+    std::ifstream vmstat("/proc/vmstat");
+    std::string key;
+    uint64_t value;
+
+    while (vmstat >> key >> value) {
+        if (key == "numa_pages_migrated") {
+            return value;
+        }
+    }
+
+    return 0;
+}
+
+void NumaReport::query_pages(Buffer &buffer) {
+    const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+
+    const uintptr_t first_page = buffer.start & ~(page_size - 1);
+    const uintptr_t end = buffer.start + buffer.size;
+    const size_t num_pages = (end - first_page + page_size - 1) / page_size;
+
+    if (num_pages == 0) {
+        return;
+    }
+
+    // Sample big buffers.
+    const size_t stride = (num_pages + MAX_QUERIED_PAGES - 1) / MAX_QUERIED_PAGES;
+
+    std::vector<void *> pages;
+    for (size_t p = 0; p < num_pages; p += stride) {
+        pages.push_back(reinterpret_cast<void *>(first_page + p * page_size));
+    }
+
+    std::vector<int> status(pages.size(), -1);
+
+    // With nodes = NULL, move_pages only returns the node of every page.
+    if (syscall(__NR_move_pages, 0, pages.size(), pages.data(), NULL, status.data(), 0) != 0) {
+        print_error("%16s: ERROR querying pages %s\n", buffer.name.c_str(), strerror(errno));
+        return;
+    }
+
+    std::fill(buffer.pages.begin(), buffer.pages.end(), 0);
+    buffer.not_present = 0;
+
+    for (const auto &node : status) {
+        if (node >= 0 && node < num_nodes) {
+            buffer.pages[node] += stride;
+        }
+        else {
+            buffer.not_present += stride;
+        }
+    }
+
+    int policy = MPOL_DEFAULT;
+    if (syscall(__NR_get_mempolicy, &policy, NULL, 0, pages[0], MPOL_F_ADDR) == 0) {
+        buffer.policy = policy;
+    }
+}
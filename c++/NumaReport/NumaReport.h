@@ -0,0 +1,204 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @author Lorién López Villellas (lorien.lopez@bsc.es)
+ *
+ * A module for reporting how the memory accesses and the pages of a program
+ * are placed on the NUMA nodes of a machine.
+ *
+ * For a play()/pause() window the report shows:
+ *   - The node of every measured thread.
+ *   - Local and remote DRAM accesses issued from every node (perf NODE events:
+ *     node read accesses count every DRAM access, node read misses count the
+ *     remote ones).
+ *   - The memory policy and the pages resident on every node of the
+ *     registered buffers (get_mempolicy and move_pages).
+ *   - CPU migrations of the measured threads and the pages migrated by the
+ *     kernel (system-wide, from /proc/vmstat).
+ *
+ * A NumaReport works the same way a stopwatch does, you can restart the
+ * report, start measuring by playing it, or stop measuring by pausing it.
+ * With -DHPCTOOLS_DISABLE_INSTRUMENTATION no counter is opened and play()
+ * and pause() do nothing.
+ *
+ * Warning: Counters are opened per thread. Every thread to measure, besides
+ * the one that builds the report, must call add_thread() once.
+ */
+
+class NumaReport {
+public:
+    /**
+     * Initializes the report and adds the calling thread. Also performs a
+     * restart().
+     *
+     */
+    NumaReport();
+
+    NumaReport(const NumaReport &other) = delete;
+    NumaReport &operator=(const NumaReport &other) = delete;
+
+    /**
+     * Destroys the report.
+     *
+     */
+    ~NumaReport();
+
+    /**
+     * Start measuring the calling thread.
+     *
+     */
+    void add_thread();
+
+    /**
+     * Register a buffer whose page placement will be reported.
+     *
+     * @param name Name of the buffer.
+     * @param addr Start address of the buffer.
+     * @param size Size of the buffer in bytes.
+     */
+    void register_buffer(const std::string &name, const void *addr, const size_t size);
+
+    /**
+     * Restarts the counters.
+     *
+     */
+    void restart();
+
+    /**
+     * Start measuring.
+     *
+     */
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+    void play();
+#else
+    void play() {}
+#endif
+
+    /**
+     * Stop measuring and take a snapshot of the page placement of the
+     * registered buffers.
+     *
+     */
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+    void pause();
+#else
+    void pause() {}
+#endif
+
+    /**
+     * Print the report into stdout.
+     *
+     */
+    void print_report() const;
+
+    /**
+     * Get the number of NUMA nodes.
+     *
+     */
+    int get_num_nodes() const;
+
+    /**
+     * Get the local DRAM accesses of the threads running on a node.
+     *
+     * @param node NUMA node.
+     */
+    uint64_t get_local_accesses(const int node) const;
+
+    /**
+     * Get the remote DRAM accesses of the threads running on a node.
+     *
+     * @param node NUMA node.
+     */
+    uint64_t get_remote_accesses(const int node) const;
+
+    /**
+     * Get the pages of a registered buffer resident on a node.
+     *
+     * If the buffer is not registered or the node does not exist, the
+     * function will throw an exception.
+     *
+     * @param name Name of the buffer.
+     * @param node NUMA node.
+     */
+    uint64_t get_pages(const std::string &name, const int node) const;
+
+    /**
+     * Get the pages migrated by the kernel during the measured windows
+     * (system-wide).
+     *
+     */
+    uint64_t get_migrated_pages() const;
+
+private:
+    enum Counter {
+        NODE_ACCESS,
+        NODE_MISSES,
+        CPU_MIGRATIONS,
+
+        NUM_COUNTERS
+    };
+
+    // A measured thread.
+    struct Thread {
+        pid_t tid;
+        int fd[NUM_COUNTERS];
+        uint64_t start_count[NUM_COUNTERS];
+        uint64_t total_count[NUM_COUNTERS];
+        int node;          // Node at the last pause.
+        bool node_changed; // The thread has run on several nodes.
+    };
+
+    // A registered buffer.
+    struct Buffer {
+        std::string name;
+        uintptr_t start;
+        size_t size;
+        int policy;                 // Memory policy of the first page.
+        std::vector<uint64_t> pages; // Pages per node.
+        uint64_t not_present;       // Pages not touched yet.
+    };
+
+    // Counter description.
+    static const char *descriptors[NUM_COUNTERS];
+
+    // Max. number of pages of a buffer queried, bigger buffers are sampled.
+    static const size_t MAX_QUERIED_PAGES = 1 << 16;
+
+    int num_nodes;
+    std::vector<int> cpu_node; // Node of every CPU.
+
+    mutable std::mutex mutex; // Protects threads.
+    std::vector<Thread> threads;
+
+    std::vector<Buffer> buffers;
+
+    uint64_t start_migrated;
+    uint64_t total_migrated;
+
+    /**
+     * Get the node a thread is running on.
+     *
+     * @param tid Thread ID.
+     * @return int NUMA node, -1 if unknown.
+     */
+    int get_thread_node(const pid_t tid) const;
+
+    /**
+     * Get the number of pages migrated by the kernel (system-wide).
+     *
+     */
+    static uint64_t read_migrated_pages();
+
+    /**
+     * Update the page placement of a buffer.
+     *
+     */
+    void query_pages(Buffer &buffer);
+};
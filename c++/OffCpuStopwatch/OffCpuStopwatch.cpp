@@ -0,0 +1,278 @@
+#define _GNU_SOURCE 1
+
+#include "OffCpuStopwatch.h"
+
+#include "printer.h"
+
+#include <asm/unistd.h>
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+// Counter description.
+const char *OffCpuStopwatch::descriptors[NUM_COUNTERS] = {
+    "on CPU ns",
+    "runnable ns",
+    "I/O stall ns",
+    "voluntary cs",
+    "involuntary cs",
+    "minor faults",
+    "major faults",
+};
+
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+/**
+ * Nanoseconds between two timestamps.
+ *
+ */
+static uint64_t elapsed_ns(const timespec &start, const timespec &stop) {
+    return (stop.tv_sec - start.tv_sec) * 1000000000L + (stop.tv_nsec - start.tv_nsec);
+}
+#endif
+
+/**
+ * Path of a /proc file of a thread of this process.
+ *
+ */
+static std::string task_path(const pid_t tid, const char *file) {
+    return "/proc/self/task/" + std::to_string(tid) + "/" + file;
+}
+
+OffCpuStopwatch::OffCpuStopwatch() : total_wall(0) {
+    add_thread();
+
+    restart();
+}
+
+OffCpuStopwatch::~OffCpuStopwatch() {
+    for (const auto &thread : threads) {
+        if (thread.fd != -1) {
+            ioctl(thread.fd, PERF_EVENT_IOC_DISABLE, 0);
+            close(thread.fd);
+        }
+    }
+}
+
+void OffCpuStopwatch::add_thread() {
+    Thread thread;
+    thread.tid = syscall(__NR_gettid);
+
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+    struct perf_event_attr pe;
+
+    memset(&pe, 0, sizeof(struct perf_event_attr));
+    pe.size = sizeof(struct perf_event_attr);
+    pe.type = PERF_TYPE_SOFTWARE;
+    pe.config = PERF_COUNT_SW_TASK_CLOCK;
+
+    // Only the calling thread, always enabled.
+    thread.fd = syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+
+    if (thread.fd == -1) {
+        print_warning("Error opening event %llx (task clock) %s, using schedstat\n",
+                      pe.config, strerror(errno));
+    }
+#else
+    thread.fd = -1;
+#endif
+
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+        thread.start_count[c] = 0;
+        thread.total_count[c] = 0;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    threads.push_back(thread);
+}
+
+void OffCpuStopwatch::restart() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto &thread : threads) {
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            thread.total_count[c] = 0;
+        }
+    }
+
+    total_wall = 0;
+}
+
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+void OffCpuStopwatch::play() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto &thread : threads) {
+        read_counters(thread, thread.start_count);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+}
+
+void OffCpuStopwatch::pause() {
+    timespec stop_time;
+    clock_gettime(CLOCK_MONOTONIC, &stop_time);
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    total_wall += elapsed_ns(start_time, stop_time);
+
+    for (auto &thread : threads) {
+        uint64_t stop_count[NUM_COUNTERS];
+        read_counters(thread, stop_count);
+
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            // Counters of a finished thread can no longer be read.
+            if (stop_count[c] >= thread.start_count[c]) {
+                thread.total_count[c] += stop_count[c] - thread.start_count[c];
+            }
+        }
+    }
+}
+#endif
+
+void OffCpuStopwatch::print_all_counters() const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    printf("%16s: %14.6lf s\n", "wall", total_wall / 1e9);
+
+    printf("%16s %12s %12s %12s %12s %10s %10s %10s %10s\n", "thread", "on CPU s", "runnable s",
+           "blocked s", "I/O stall s", "vol cs", "invol cs", "minflt", "majflt");
+
+    for (const auto &thread : threads) {
+        const uint64_t on_cpu = thread.total_count[ON_CPU_NS];
+        const uint64_t runnable = thread.total_count[RUNNABLE_NS];
+        const uint64_t blocked = total_wall > on_cpu + runnable ? total_wall - on_cpu - runnable : 0;
+
+        printf("%16d %12.6lf %12.6lf %12.6lf %12.6lf %10lu %10lu %10lu %10lu\n", thread.tid,
+               on_cpu / 1e9, runnable / 1e9, blocked / 1e9, thread.total_count[IO_STALL_NS] / 1e9,
+               thread.total_count[VOLUNTARY_SWITCHES], thread.total_count[INVOLUNTARY_SWITCHES],
+               thread.total_count[MINOR_FAULTS], thread.total_count[MAJOR_FAULTS]);
+    }
+}
+
+uint64_t OffCpuStopwatch::get_counter(const Counter target_counter, const pid_t tid) const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return find_thread(tid).total_count[target_counter];
+}
+
+uint64_t OffCpuStopwatch::get_counter(const Counter target_counter) const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint64_t count = 0;
+    for (const auto &thread : threads) {
+        count += thread.total_count[target_counter];
+    }
+
+    return count;
+}
+
+uint64_t OffCpuStopwatch::get_blocked_ns(const pid_t tid) const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    const Thread &thread = find_thread(tid);
+
+    const uint64_t on_cpu = thread.total_count[ON_CPU_NS] + thread.total_count[RUNNABLE_NS];
+
+    return total_wall > on_cpu ? total_wall - on_cpu : 0;
+}
+
+uint64_t OffCpuStopwatch::get_wall_ns() const {
+    return total_wall;
+}
+
+std::vector<pid_t> OffCpuStopwatch::get_threads() const {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::vector<pid_t> tids;
+    for (const auto &thread : threads) {
+        tids.push_back(thread.tid);
+    }
+
+    return tids;
+}
+
+const char *OffCpuStopwatch::get_descriptor(const Counter target_counter) {
+    return descriptors[target_counter];
+}
+
+void OffCpuStopwatch::read_counters(const Thread &thread, uint64_t count[NUM_COUNTERS]) const {
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+        count[c] = 0;
+    }
+
+    // schedstat: time on CPU (ns), time waiting on a runqueue (ns), timeslices.
+    std::ifstream schedstat(task_path(thread.tid, "schedstat"));
+    uint64_t on_cpu = 0;
+    schedstat >> on_cpu >> count[RUNNABLE_NS];
+
+    if (thread.fd == -1 ||
+        sizeof(uint64_t) != read(thread.fd, &count[ON_CPU_NS], sizeof(uint64_t))) {
+        count[ON_CPU_NS] = on_cpu;
+    }
+
+    // status: context switches.
+    std::ifstream status(task_path(thread.tid, "status"));
+    std::string line;
+
+    while (std::getline(status, line)) {
+        unsigned long value;
+
+        if (sscanf(line.c_str(), "voluntary_ctxt_switches: %lu", &value) == 1) {
+            count[VOLUNTARY_SWITCHES] = value;
+        }
+        else if (sscanf(line.c_str(), "nonvoluntary_ctxt_switches: %lu", &value) == 1) {
+            count[INVOLUNTARY_SWITCHES] = value;
+        }
+    }
+
+    // stat: minflt is the 10th field, majflt the 12th and
+    // delayacct_blkio_ticks the 42nd.
+    std::ifstream stat(task_path(thread.tid, "stat"));
+
+    if (!std::getline(stat, line)) {
+        return;
+    }
+
+    // The command may contain spaces, skip it.
+    const size_t end_comm = line.rfind(')');
+    if (end_comm == std::string::npos) {
+        return;
+    }
+
+    std::stringstream fields(line.substr(end_comm + 2));
+    std::string field;
+
+    static const long ticks_per_sec = sysconf(_SC_CLK_TCK);
+
+    // Fields after the command start at 3.
+    for (int i = 3; i <= 42 && fields >> field; ++i) {
+        if (i == 10) {
+            count[MINOR_FAULTS] = strtoull(field.c_str(), NULL, 10);
+        }
+        else if (i == 12) {
+            count[MAJOR_FAULTS] = strtoull(field.c_str(), NULL, 10);
+        }
+        else if (i == 42) {
+            count[IO_STALL_NS] = strtoull(field.c_str(), NULL, 10) * (1000000000UL / ticks_per_sec);
+        }
+    }
+}
+
+const OffCpuStopwatch::Thread &OffCpuStopwatch::find_thread(const pid_t tid) const {
+    for (const auto &thread : threads) {
+        if (thread.tid == tid) {
+            return thread;
+        }
+    }
+
+    throw std::runtime_error("OffCpuStopwatch: Trying to read a non measured thread");
+}
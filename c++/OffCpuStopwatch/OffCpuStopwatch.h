@@ -0,0 +1,185 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#include <mutex>
+#include <vector>
+
+/**
+ * @author Lorién López Villellas (lorien.lopez@bsc.es)
+ *
+ * A module for splitting the wall time of a play()/pause() window into the
+ * time every thread spends on and off the CPU:
+ *
+ *   - on CPU: task clock of the thread (perf, /proc schedstat if perf is
+ *     not available).
+ *   - runnable: time waiting on a runqueue for a CPU (/proc schedstat),
+ *     a sign of oversubscription.
+ *   - blocked: the rest of the wall time, the thread was sleeping (I/O,
+ *     locks, MPI progress, barriers...).
+ *   - I/O + fault stall: part of blocked spent waiting for block I/O,
+ *     including major page faults (delayacct_blkio_ticks, requires
+ *     kernel.task_delayacct=1).
+ *
+ * Voluntary (the thread blocked) and involuntary (the thread was preempted)
+ * context switches and minor/major page faults are counted too.
+ *
+ * An OffCpuStopwatch works the same way a stopwatch does, you can restart the
+ * stopwatch, start measuring by playing it, or stop measuring by pausing it.
+ * With -DHPCTOOLS_DISABLE_INSTRUMENTATION play() and pause() do nothing and
+ * every counter reads 0.
+ *
+ * Warning: Counters are kept per thread. Every thread to measure, besides
+ * the one that builds the stopwatch, must call add_thread() once, and must
+ * be alive when the stopwatch is played and paused (the /proc files of a
+ * finished thread can no longer be read).
+ */
+
+class OffCpuStopwatch {
+public:
+    enum Counter {
+        ON_CPU_NS,
+        RUNNABLE_NS,
+        IO_STALL_NS,
+        VOLUNTARY_SWITCHES,
+        INVOLUNTARY_SWITCHES,
+        MINOR_FAULTS,
+        MAJOR_FAULTS,
+
+        NUM_COUNTERS
+    };
+
+    /**
+     * Initializes the stopwatch and adds the calling thread. Also performs
+     * a restart().
+     *
+     */
+    OffCpuStopwatch();
+
+    OffCpuStopwatch(const OffCpuStopwatch &other) = delete;
+    OffCpuStopwatch &operator=(const OffCpuStopwatch &other) = delete;
+
+    /**
+     * Destroys the stopwatch.
+     *
+     */
+    ~OffCpuStopwatch();
+
+    /**
+     * Start measuring the calling thread.
+     *
+     */
+    void add_thread();
+
+    /**
+     * Restarts the counters.
+     *
+     */
+    void restart();
+
+    /**
+     * Start measuring.
+     *
+     */
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+    void play();
+#else
+    void play() {}
+#endif
+
+    /**
+     * Stop measuring.
+     *
+     */
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+    void pause();
+#else
+    void pause() {}
+#endif
+
+    /**
+     * Print the breakdown of every thread into stdout.
+     *
+     */
+    void print_all_counters() const;
+
+    /**
+     * Get a counter of a thread.
+     *
+     * If the thread is not measured, the function will throw an exception.
+     *
+     * @param target_counter counter reference.
+     * @param tid Thread ID.
+     */
+    uint64_t get_counter(const Counter target_counter, const pid_t tid) const;
+
+    /**
+     * Get a counter summed over every thread.
+     *
+     * @param target_counter counter reference.
+     */
+    uint64_t get_counter(const Counter target_counter) const;
+
+    /**
+     * Get the blocked time (wall - on CPU - runnable) of a thread in
+     * nanoseconds.
+     *
+     * If the thread is not measured, the function will throw an exception.
+     *
+     * @param tid Thread ID.
+     */
+    uint64_t get_blocked_ns(const pid_t tid) const;
+
+    /**
+     * Get the wall time in nanoseconds.
+     *
+     */
+    uint64_t get_wall_ns() const;
+
+    /**
+     * Get the IDs of the measured threads.
+     *
+     */
+    std::vector<pid_t> get_threads() const;
+
+    /**
+     * Get the counter descriptor referred by COUNTER.
+     *
+     * @param target_counter counter reference.
+     * @return const char* (counter descriptor).
+     */
+    static const char *get_descriptor(const Counter target_counter);
+
+private:
+    // A measured thread.
+    struct Thread {
+        pid_t tid;
+        int fd; // perf task clock, -1 if not available.
+        uint64_t start_count[NUM_COUNTERS];
+        uint64_t total_count[NUM_COUNTERS];
+    };
+
+    // Counter description.
+    static const char *descriptors[NUM_COUNTERS];
+
+    mutable std::mutex mutex; // Protects threads.
+    std::vector<Thread> threads;
+
+    timespec start_time;  // Last play timestamp.
+    uint64_t total_wall;  // Total wall time (ns).
+
+    /**
+     * Read the current value of every counter of a thread.
+     *
+     */
+    void read_counters(const Thread &thread, uint64_t count[NUM_COUNTERS]) const;
+
+    /**
+     * Get a measured thread.
+     *
+     * If the thread is not measured, the function will throw an exception.
+     *
+     */
+    const Thread &find_thread(const pid_t tid) const;
+};
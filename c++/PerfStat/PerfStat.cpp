@@ -0,0 +1,387 @@
+#define _GNU_SOURCE 1
+
+#include "PerfStat.h"
+
+#include "printer.h"
+
+#include <asm/unistd.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <stdexcept>
+
+// Derived metrics.
+const PerfStat::Derived PerfStat::derived[] = {
+    {"IPC", PerfStopwatch::INSTRUCTIONS, PerfStopwatch::CPU_CYCLES, 1},
+    {"GHz", PerfStopwatch::CPU_CYCLES, PerfStopwatch::TASK_CLOCK, 1},
+    {"CPUs utilized", PerfStopwatch::TASK_CLOCK, PerfStopwatch::NUM_EVENTS, 1},
+    {"branch miss %", PerfStopwatch::BRANCH_MISSES, PerfStopwatch::BRANCH_INSTRUCTIONS, 100},
+    {"cache miss %", PerfStopwatch::CACHE_MISSES, PerfStopwatch::CACHE_REFERENCES, 100},
+    {"L1D miss %", PerfStopwatch::L1D_READ_MISSES, PerfStopwatch::L1D_READ_ACCESS, 100},
+    {"LL miss %", PerfStopwatch::LL_READ_MISSES, PerfStopwatch::LL_READ_ACCESS, 100},
+    {"DTLB miss %", PerfStopwatch::DTLB_READ_MISSES, PerfStopwatch::DTLB_READ_ACCESS, 100},
+};
+
+/**
+ * Normalize an event name (lower case, '-' and '_' as spaces).
+ *
+ */
+static std::string normalize(const std::string &name) {
+    std::string normalized(name);
+
+    for (auto &c : normalized) {
+        c = (c == '-' || c == '_') ? ' ' : tolower(c);
+    }
+
+    return normalized;
+}
+
+/**
+ * Print a string as a JSON string.
+ *
+ */
+static void print_json_string(FILE *file, const std::string &str) {
+    fputc('"', file);
+
+    for (const auto &c : str) {
+        if (c == '"' || c == '\\') {
+            fputc('\\', file);
+            fputc(c, file);
+        }
+        else if ((unsigned char)c < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        }
+        else {
+            fputc(c, file);
+        }
+    }
+
+    fputc('"', file);
+}
+
+PerfStat::PerfStat(const std::vector<PerfStopwatch::Event> &req_events_) :
+    req_events(req_events_),
+    opened(req_events_.size(), false),
+    total_count(req_events_.size(), 0),
+    running_ratio(req_events_.size(), 0),
+    exit_status(0),
+    total_secs(0) {}
+
+int PerfStat::run(char *const argv[]) {
+    command.clear();
+    for (int i = 0; argv[i] != nullptr; ++i) {
+        command += (i == 0 ? "" : " ") + std::string(argv[i]);
+    }
+
+    // The child waits until its counters are opened.
+    int go[2];
+    if (pipe2(go, O_CLOEXEC) != 0) {
+        print_error("PerfStat: Error creating pipe %s\n", strerror(errno));
+        return exit_status = 127;
+    }
+
+    const pid_t pid = fork();
+
+    if (pid == -1) {
+        print_error("PerfStat: Error forking %s\n", strerror(errno));
+        close(go[0]);
+        close(go[1]);
+        return exit_status = 127;
+    }
+
+    if (pid == 0) {
+        close(go[1]);
+
+        char c;
+        if (read(go[0], &c, 1) != 1) {
+            // The launcher has failed.
+            _exit(127);
+        }
+
+        execvp(argv[0], argv);
+
+        print_error("PerfStat: Error running %s %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+
+    close(go[0]);
+
+    std::vector<int> fd(req_events.size(), -1);
+
+    for (size_t i = 0; i < req_events.size(); ++i) {
+        const auto &event = req_events[i];
+
+        struct perf_event_attr pe;
+
+        memset(&pe, 0, sizeof(struct perf_event_attr));
+        pe.size = sizeof(struct perf_event_attr);
+        pe.disabled = 1;
+
+        // Start counting when the command is exec'd.
+        pe.enable_on_exec = 1;
+
+        // Type of event to measure.
+        pe.type = PerfStopwatch::get_type(event);
+        pe.config = PerfStopwatch::get_config(event);
+
+        // Exclude kernel and hypervisor from being measured. Software events
+        // (context switches, migrations...) only happen in the kernel.
+        pe.exclude_kernel = pe.type != PERF_TYPE_SOFTWARE;
+        pe.exclude_hv = 1;
+
+        // Children inherit it
+        pe.inherit = 1;
+
+        // Needed to scale multiplexed counters.
+        pe.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        fd[i] = syscall(__NR_perf_event_open, &pe, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+
+        // perf_event_paranoid may not allow counting in the kernel.
+        if (fd[i] == -1 && !pe.exclude_kernel && (errno == EACCES || errno == EPERM)) {
+            pe.exclude_kernel = 1;
+            fd[i] = syscall(__NR_perf_event_open, &pe, pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        }
+
+        if (fd[i] == -1) {
+            print_error("Error opening event %llx (%s) %s\n",
+                        pe.config, PerfStopwatch::get_descriptor(event), strerror(errno));
+        }
+    }
+
+    // Do not die with the command on Ctrl-C, report its counters instead.
+    struct sigaction ignore, old_int, old_quit;
+    memset(&ignore, 0, sizeof(struct sigaction));
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGINT, &ignore, &old_int);
+    sigaction(SIGQUIT, &ignore, &old_quit);
+
+    timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    // Let the command run.
+    if (write(go[1], "x", 1) != 1) {
+        print_error("PerfStat: Error starting %s %s\n", argv[0], strerror(errno));
+    }
+    close(go[1]);
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+    }
+
+    timespec stop_time;
+    clock_gettime(CLOCK_MONOTONIC, &stop_time);
+
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGQUIT, &old_quit, NULL);
+
+    total_secs = (stop_time.tv_sec - start_time.tv_sec) +
+                 (stop_time.tv_nsec - start_time.tv_nsec) / 1000000000.0;
+
+    for (size_t i = 0; i < req_events.size(); ++i) {
+        opened[i] = false;
+        total_count[i] = 0;
+        running_ratio[i] = 0;
+
+        if (fd[i] == -1) {
+            continue;
+        }
+
+        // value, time enabled, time running.
+        uint64_t values[3];
+
+        if (sizeof(values) != read(fd[i], values, sizeof(values))) {
+            print_error("%16s: ERROR reading perf event.\n",
+                        PerfStopwatch::get_descriptor(req_events[i]));
+        }
+        else {
+            opened[i] = true;
+
+            if (values[2] > 0 && values[2] < values[1]) {
+                total_count[i] = values[0] * ((double)values[1] / values[2]);
+                running_ratio[i] = (double)values[2] / values[1];
+            }
+            else {
+                total_count[i] = values[0];
+                running_ratio[i] = 1;
+            }
+        }
+
+        close(fd[i]);
+    }
+
+    if (WIFEXITED(status)) {
+        exit_status = WEXITSTATUS(status);
+    }
+    else if (WIFSIGNALED(status)) {
+        exit_status = 128 + WTERMSIG(status);
+    }
+    else {
+        exit_status = 127;
+    }
+
+    return exit_status;
+}
+
+void PerfStat::print_all_counters(FILE *file) const {
+    for (size_t i = 0; i < req_events.size(); ++i) {
+        if (!opened[i]) {
+            continue;
+        }
+
+        fprintf(file, "%16s: %14lu", PerfStopwatch::get_descriptor(req_events[i]), total_count[i]);
+
+        if (running_ratio[i] < 1) {
+            fprintf(file, " (%.1lf%% running)", 100 * running_ratio[i]);
+        }
+
+        fprintf(file, "\n");
+    }
+
+    fprintf(file, "%16s: %14.6lf\n", "seconds", total_secs);
+}
+
+void PerfStat::print_derived(FILE *file) const {
+    for (const auto &metric : get_derived(get_events(), get_counts(), total_secs)) {
+        fprintf(file, "%16s: %14.3lf\n", metric.first.c_str(), metric.second);
+    }
+}
+
+void PerfStat::print_json(FILE *file) const {
+    fprintf(file, "{\n  \"command\": ");
+    print_json_string(file, command);
+    fprintf(file, ",\n  \"exit_status\": %d,\n  \"seconds\": %.9lf,\n  \"counters\": {",
+            exit_status, total_secs);
+
+    bool first = true;
+    for (size_t i = 0; i < req_events.size(); ++i) {
+        if (opened[i]) {
+            fprintf(file, "%s\n    \"%s\": %lu", first ? "" : ",",
+                    PerfStopwatch::get_descriptor(req_events[i]), total_count[i]);
+            first = false;
+        }
+    }
+
+    fprintf(file, "\n  },\n  \"derived\": {");
+
+    first = true;
+    for (const auto &metric : get_derived(get_events(), get_counts(), total_secs)) {
+        fprintf(file, "%s\n    \"%s\": %.6lf", first ? "" : ",", metric.first.c_str(),
+                metric.second);
+        first = false;
+    }
+
+    fprintf(file, "\n  },\n  \"unsupported\": [");
+
+    first = true;
+    for (size_t i = 0; i < req_events.size(); ++i) {
+        if (!opened[i]) {
+            fprintf(file, "%s\"%s\"", first ? "" : ", ",
+                    PerfStopwatch::get_descriptor(req_events[i]));
+            first = false;
+        }
+    }
+
+    fprintf(file, "]\n}\n");
+}
+
+uint64_t PerfStat::get_counter(const PerfStopwatch::Event target_event) const {
+    for (size_t i = 0; i < req_events.size(); ++i) {
+        if (req_events[i] == target_event && opened[i]) {
+            return total_count[i];
+        }
+    }
+
+    throw std::runtime_error("PerfStat: Trying to read a non counted event");
+}
+
+std::vector<PerfStopwatch::Event> PerfStat::get_events() const {
+    std::vector<PerfStopwatch::Event> events;
+
+    for (size_t i = 0; i < req_events.size(); ++i) {
+        if (opened[i]) {
+            events.push_back(req_events[i]);
+        }
+    }
+
+    return events;
+}
+
+double PerfStat::get_s() const {
+    return total_secs;
+}
+
+std::vector<PerfStopwatch::Event> PerfStat::default_events() {
+    return {
+        PerfStopwatch::CPU_CYCLES,
+        PerfStopwatch::INSTRUCTIONS,
+        PerfStopwatch::CACHE_REFERENCES,
+        PerfStopwatch::CACHE_MISSES,
+        PerfStopwatch::BRANCH_INSTRUCTIONS,
+        PerfStopwatch::BRANCH_MISSES,
+        PerfStopwatch::TASK_CLOCK,
+        PerfStopwatch::CONTEXT_SWITCHES,
+        PerfStopwatch::CPU_MIGRATIONS,
+        PerfStopwatch::PAGE_FAULTS,
+    };
+}
+
+bool PerfStat::parse_event(const std::string &name, PerfStopwatch::Event &event) {
+    const std::string target = normalize(name);
+
+    for (int e = 0; e < PerfStopwatch::NUM_EVENTS; ++e) {
+        if (normalize(PerfStopwatch::get_descriptor((PerfStopwatch::Event)e)) == target) {
+            event = (PerfStopwatch::Event)e;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+std::vector<std::pair<std::string, double>>
+PerfStat::get_derived(const std::vector<PerfStopwatch::Event> &events,
+                      const std::vector<uint64_t> &counts, const double secs) {
+    std::vector<std::pair<std::string, double>> values;
+
+    for (const auto &metric : derived) {
+        double numerator = -1;
+        // NUM_EVENTS stands for the wall time (ns).
+        double denominator = metric.denominator == PerfStopwatch::NUM_EVENTS ? secs * 1e9 : -1;
+
+        for (size_t i = 0; i < events.size(); ++i) {
+            if (events[i] == metric.numerator) {
+                numerator = counts[i];
+            }
+            if (events[i] == metric.denominator) {
+                denominator = counts[i];
+            }
+        }
+
+        if (numerator >= 0 && denominator > 0) {
+            values.push_back({metric.name, numerator / denominator * metric.factor});
+        }
+    }
+
+    return values;
+}
+
+std::vector<uint64_t> PerfStat::get_counts() const {
+    std::vector<uint64_t> counts;
+
+    for (size_t i = 0; i < req_events.size(); ++i) {
+        if (opened[i]) {
+            counts.push_back(total_count[i]);
+        }
+    }
+
+    return counts;
+}
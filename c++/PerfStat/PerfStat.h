@@ -0,0 +1,144 @@
+#pragma once
+
+#include "../PerfStopwatch/PerfStopwatch.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @author Lorién López Villellas (lorien.lopez@bsc.es)
+ *
+ * A module for counting the PerfStopwatch events of a whole, unmodified
+ * command (perf stat style).
+ *
+ * The command is forked and blocked until its counters are opened. Counters
+ * are enabled when the command calls exec (enable_on_exec), so the launcher
+ * itself is not measured, and are inherited by every thread and process the
+ * command creates. The counts of the children are added when they finish.
+ *
+ * If the kernel multiplexes the counters, the counts are scaled by
+ * time enabled / time running.
+ *
+ * See perfstat.cpp for the command line launcher.
+ */
+
+class PerfStat {
+public:
+    /**
+     * Initializes the launcher.
+     *
+     * @param req_events_ perf events to count.
+     */
+    PerfStat(const std::vector<PerfStopwatch::Event> &req_events_ = default_events());
+
+    /**
+     * Run a command and count its events.
+     *
+     * @param argv Command and arguments (nullptr terminated).
+     * @return int exit status of the command, 128 + signal if it was killed,
+     *         127 if it could not be run.
+     */
+    int run(char *const argv[]);
+
+    /**
+     * Print the counter of every counted event into FILE.
+     *
+     */
+    void print_all_counters(FILE *file = stdout) const;
+
+    /**
+     * Print the derived metrics (IPC, miss ratios...) whose events are
+     * counted into FILE.
+     *
+     */
+    void print_derived(FILE *file = stdout) const;
+
+    /**
+     * Print the counters and the derived metrics as a JSON object into FILE.
+     *
+     */
+    void print_json(FILE *file = stdout) const;
+
+    /**
+     * Get the PerfStat event counter referred by EVENT.
+     *
+     * If the event is not being counted, the function will throw an
+     * exception.
+     *
+     * @param target_event event reference.
+     */
+    uint64_t get_counter(const PerfStopwatch::Event target_event) const;
+
+    /**
+     * Get the events being counted (requested and successfully opened).
+     *
+     */
+    std::vector<PerfStopwatch::Event> get_events() const;
+
+    /**
+     * Get the wall time of the command in seconds.
+     *
+     */
+    double get_s() const;
+
+    /**
+     * Default events: cycles, instructions, cache and branch events, task
+     * clock, context switches, CPU migrations and page faults.
+     *
+     */
+    static std::vector<PerfStopwatch::Event> default_events();
+
+    /**
+     * Get the event whose descriptor is NAME. Case, '-' and '_' are ignored
+     * ("LL-read-misses" is "LL read misses").
+     *
+     * @param name Event name.
+     * @param event Output event.
+     * @return true if the event exists, false otherwise.
+     */
+    static bool parse_event(const std::string &name, PerfStopwatch::Event &event);
+
+    /**
+     * Compute the derived metrics (IPC, miss ratios...) whose events are
+     * counted.
+     *
+     * @param events Counted events.
+     * @param counts Counter of every event.
+     * @param secs Wall time in seconds.
+     * @return std::vector<std::pair<std::string, double>> name and value of
+     *         every derived metric.
+     */
+    static std::vector<std::pair<std::string, double>>
+    get_derived(const std::vector<PerfStopwatch::Event> &events,
+                const std::vector<uint64_t> &counts, const double secs);
+
+private:
+    // A derived metric: numerator / denominator * factor.
+    struct Derived {
+        const char *name;
+        PerfStopwatch::Event numerator;
+        PerfStopwatch::Event denominator;
+        double factor;
+    };
+
+    static const Derived derived[];
+
+    std::vector<PerfStopwatch::Event> req_events; // Events being counted.
+
+    std::vector<bool> opened;          // The event could be opened.
+    std::vector<uint64_t> total_count; // Scaled count of every event.
+    std::vector<double> running_ratio; // Time running / time enabled.
+
+    std::string command; // Last command run.
+    int exit_status;     // Exit status of the last command.
+    double total_secs;   // Wall time of the last command.
+
+    /**
+     * Get the counter of every counted event (see get_events()).
+     *
+     */
+    std::vector<uint64_t> get_counts() const;
+};
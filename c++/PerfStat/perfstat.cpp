@@ -0,0 +1,114 @@
+/**
+ * @author Lorién López Villellas (lorien.lopez@bsc.es)
+ *
+ * Count the PerfStopwatch events of an unmodified command, including every
+ * thread and process it creates (see PerfStat). The counters and the derived
+ * metrics are printed into stderr, so the output of the command is not
+ * altered, and optionally written as JSON.
+ *
+ * Usage: perfstat [-e event,event,...] [-o output.json] [--] command [args...]
+ *
+ * Events are PerfStopwatch descriptors, '-' or '_' can replace the spaces
+ * ("-e cpu-cycles,instructions,LL-read-misses").
+ *
+ * The exit status is the one of the command, so it can wrap the command of
+ * regression.sh directly:
+ *
+ *    command="perfstat -o metrics.json ./my_app input.dat"
+ */
+
+#include "PerfStat.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * Print the usage and the available events.
+ *
+ */
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-e event,event,...] [-o output.json] [--] command [args...]\n",
+            program);
+    fprintf(stderr, "\nEvents:\n");
+
+    for (int e = 0; e < PerfStopwatch::NUM_EVENTS; ++e) {
+        fprintf(stderr, "  %s\n", PerfStopwatch::get_descriptor((PerfStopwatch::Event)e));
+    }
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<PerfStopwatch::Event> events = PerfStat::default_events();
+    const char *json_path = nullptr;
+
+    int arg = 1;
+    while (arg < argc && argv[arg][0] == '-') {
+        const std::string option(argv[arg]);
+
+        if (option == "--") {
+            ++arg;
+            break;
+        }
+        else if (option == "-e" && arg + 1 < argc) {
+            events.clear();
+
+            std::stringstream names(argv[arg + 1]);
+            std::string name;
+
+            while (std::getline(names, name, ',')) {
+                PerfStopwatch::Event event;
+
+                if (!PerfStat::parse_event(name, event)) {
+                    fprintf(stderr, "Unknown event %s\n", name.c_str());
+                    usage(argv[0]);
+                    return 127;
+                }
+
+                events.push_back(event);
+            }
+
+            arg += 2;
+        }
+        else if (option == "-o" && arg + 1 < argc) {
+            json_path = argv[arg + 1];
+            arg += 2;
+        }
+        else {
+            usage(argv[0]);
+            return option == "-h" ? 0 : 127;
+        }
+    }
+
+    if (arg == argc) {
+        usage(argv[0]);
+        return 127;
+    }
+
+    PerfStat stat(events);
+
+    const int status = stat.run(&argv[arg]);
+
+    fprintf(stderr, "\n");
+    stat.print_all_counters(stderr);
+    fprintf(stderr, "\n");
+    stat.print_derived(stderr);
+
+    if (json_path != nullptr) {
+        FILE *json = strcmp(json_path, "-") == 0 ? stdout : fopen(json_path, "w");
+
+        if (json == nullptr) {
+            perror(json_path);
+        }
+        else {
+            stat.print_json(json);
+
+            if (json != stdout) {
+                fclose(json);
+            }
+        }
+    }
+
+    return status;
+}
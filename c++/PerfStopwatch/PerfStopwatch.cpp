@@ -6,13 +6,20 @@
 
 #include <asm/unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <linux/perf_event.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <algorithm>
 #include <iostream>
+#include <mutex>
 #include <utility>
 
 // File descriptor used by perf.
@@ -22,85 +29,38 @@ int PerfStopwatch::fd[NUM_EVENTS] = {-1};
 unsigned int PerfStopwatch::tracked_events[NUM_EVENTS] = {0};
 
 // Event description.
-const char *PerfStopwatch::descriptors[NUM_EVENTS] = {
-    "cpu cycles",
-    "instructions",
-    "cache references",
-    "cache misses",
-    "branch instructions",
-    "branch misses",
-    "bus cycles",
-    "stalled cycles frontend",
-    "stalled cycles backend",
-    "ref cpu cycles",
-
-    "L1D read access",
-    "L1I read access",
-    "LL read access",
-    "DTLB read access",
-    "ITLB read access",
-    "BPU read access",
-    "NODE read access",
-
-    "L1D read misses",
-    "L1I read misses",
-    "LL read misses",
-    "DTLB read misses",
-    "ITLB read misses",
-    "BPU read misses",
-    "NODE read misses",
-
-    "L1D write access",
-    "L1I write access",
-    "LL write access",
-    "DTLB write access",
-    "ITLB write access",
-    "BPU write access",
-    "NODE write access",
-
-    "L1D write misses",
-    "L1I write misses",
-    "LL write misses",
-    "DTLB write misses",
-    "ITLB write misses",
-    "BPU write misses",
-    "NODE write misses",
-
-    "L1D prefetch access",
-    "L1I prefetch access",
-    "LL prefetch access",
-    "DTLB prefetch access",
-    "ITLB prefetch access",
-    "BPU prefetch access",
-    "NODE prefetch access",
-
-    "L1D prefetch misses",
-    "L1I prefetch misses",
-    "LL prefetch misses",
-    "DTLB prefetch misses",
-    "ITLB prefetch misses",
-    "BPU prefetch misses",
-    "NODE prefetch misses",
-
-    "cpu clock",
-    "task clock",
-    "page faults",
-    "context switches",
-    "cpu migrations",
-    "page faults min",
-    "page faults maj",
-    "alignment faults",
-    "emulation faults",
-    "dummy",
-    "bpf output",
-};
+constexpr const char *PerfStopwatch::descriptors[NUM_EVENTS];
+
+// Triggers of every stopwatch of the process.
+PerfStopwatch::Trigger PerfStopwatch::triggers[MAX_TRIGGERS];
+
+// Signal raised by the trigger counters, -1 until the handler is installed.
+static int trigger_signal = -1;
+
+/**
+ * Copy SIZE bytes at OFFSET of the data area of a perf ring into DST,
+ * wrapping around its end. Async-signal-safe.
+ *
+ */
+static void ring_copy(const struct perf_event_mmap_page *ring, uint64_t offset, void *dst,
+                      const size_t size) {
+    const char *data = (const char *)ring + ring->data_offset;
+
+    for (size_t i = 0; i < size; ++i) {
+        ((char *)dst)[i] = data[(offset + i) % ring->data_size];
+    }
+}
 
 PerfStopwatch::PerfStopwatch(const std::vector<Event> &req_events_) :
-    req_events(req_events_) {
+    req_events(req_events_),
+    trace_region(Tracer::NO_REGION),
+    metric_slot(MetricRegistry::NO_SLOT) {
     start_count.resize(req_events.size());
     total_count.resize(req_events.size());
 
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
     perf_start(req_events);
+#endif
 
     restart();
 }
@@ -108,29 +68,55 @@ PerfStopwatch::PerfStopwatch(const std::vector<Event> &req_events_) :
 PerfStopwatch::PerfStopwatch(const PerfStopwatch &other) :
     req_events(other.req_events),
     start_count(other.start_count),
-    total_count(other.total_count) {
+    total_count(other.total_count),
+    trace_region(other.trace_region),
+    metric_slot(MetricRegistry::NO_SLOT) { // A slot has a single writer.
 
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
     perf_start(req_events);
+#endif
 }
 
 PerfStopwatch::PerfStopwatch(PerfStopwatch &&other) noexcept :
     req_events(std::move(other.req_events)),
     start_count(std::move(other.start_count)),
-    total_count(std::move(other.total_count)) {}
+    total_count(std::move(other.total_count)),
+    trace_region(other.trace_region),
+    metric_slot(other.metric_slot),
+    trigger_slots(std::move(other.trigger_slots)) {
+    // A slot has a single writer.
+    other.metric_slot = MetricRegistry::NO_SLOT;
+}
 
 PerfStopwatch &PerfStopwatch::operator=(const PerfStopwatch &other) {
-    return *this = PerfStopwatch(other);
+    // Keep publishing into our own slot, if any, and keep our triggers armed
+    // (the temporary would clear them when destroyed).
+    const uint32_t slot = metric_slot;
+    std::vector<int> slots;
+    std::swap(slots, trigger_slots);
+
+    *this = PerfStopwatch(other);
+    metric_slot = slot;
+    std::swap(slots, trigger_slots);
+
+    return *this;
 }
 
 PerfStopwatch &PerfStopwatch::operator=(PerfStopwatch &&other) noexcept {
     std::swap(req_events, other.req_events);
     std::swap(start_count, other.start_count);
     std::swap(total_count, other.total_count);
+    std::swap(trace_region, other.trace_region);
+    std::swap(metric_slot, other.metric_slot);
+    std::swap(trigger_slots, other.trigger_slots);
 
     return *this;
 }
 
 PerfStopwatch::~PerfStopwatch() {
+    clear_triggers();
+
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
     // "Turn off" no longer needed hw counters.
     for (const auto &event : req_events) {
 
@@ -143,6 +129,7 @@ PerfStopwatch::~PerfStopwatch() {
             fd[event] = -1;
         }
     }
+#endif
 }
 
 void PerfStopwatch::restart() {
@@ -151,10 +138,13 @@ void PerfStopwatch::restart() {
     }
 }
 
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
 void PerfStopwatch::play() {
+    Tracer::enter(trace_region);
+
     // "Turn off" hw counters.
-    for (const auto &event : tracked_events) {
-        if (fd[event] != -1) {
+    for (int event = 0; event < NUM_EVENTS; ++event) {
+        if (tracked_events[event] > 0 && fd[event] != -1) {
             ioctl(fd[event], PERF_EVENT_IOC_DISABLE, 0);
         }
     }
@@ -173,17 +163,34 @@ void PerfStopwatch::play() {
     }
 
     // Reactivate counters.
-    for (const auto &event : tracked_events) {
-        if (fd[event] != -1) {
+    for (int event = 0; event < NUM_EVENTS; ++event) {
+        if (tracked_events[event] > 0 && fd[event] != -1) {
             ioctl(fd[event], PERF_EVENT_IOC_ENABLE, 0);
         }
     }
+
+    // Arm triggers: setting the period restarts it. The handler disables the
+    // counter on its first overflow.
+    for (const auto &slot : trigger_slots) {
+        Trigger &trigger = triggers[slot];
+
+        ioctl(trigger.fd, PERF_EVENT_IOC_PERIOD, &trigger.budget);
+        ioctl(trigger.fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
 }
 
 void PerfStopwatch::pause() {
+    // Deltas of the first requested events, for the trace.
+    uint64_t deltas[Tracer::MAX_COUNTERS] = {0};
+
+    // Disarm triggers.
+    for (const auto &slot : trigger_slots) {
+        ioctl(triggers[slot].fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+
     // "Turn off" hw counters.
-    for (const auto &event : tracked_events) {
-        if (fd[event] != -1) {
+    for (int event = 0; event < NUM_EVENTS; ++event) {
+        if (tracked_events[event] > 0 && fd[event] != -1) {
             ioctl(fd[event], PERF_EVENT_IOC_DISABLE, 0);
         }
     }
@@ -203,21 +210,31 @@ void PerfStopwatch::pause() {
         }
         else {
             total_count[i] += (stop_count - start_count[i]);
+
+            if (i < Tracer::MAX_COUNTERS) {
+                deltas[i] = stop_count - start_count[i];
+            }
         }
     }
 
     // Reactivate counters.
-    for (const auto &event : tracked_events) {
-        if (fd[event] != -1) {
+    for (int event = 0; event < NUM_EVENTS; ++event) {
+        if (tracked_events[event] > 0 && fd[event] != -1) {
             ioctl(fd[event], PERF_EVENT_IOC_ENABLE, 0);
         }
     }
+
+    Tracer::exit(trace_region, deltas, std::min(req_events.size(), (size_t)Tracer::MAX_COUNTERS));
+    MetricRegistry::publish(metric_slot, total_count.data(), total_count.size());
 }
+#endif
 
 void PerfStopwatch::print_all_counters() const {
-    for (const auto &event : req_events) {
+    for (size_t i = 0; i < req_events.size(); ++i) {
+        const auto &event = req_events[i];
+
         if (fd[event] != -1) {
-            printf("%16s: %14lu\n", descriptors[event], total_count[event]);
+            printf("%16s: %14lu\n", descriptors[event], total_count[i]);
         }
     }
 }
@@ -226,7 +243,12 @@ uint64_t PerfStopwatch::get_counter(const Event target_event) const {
     for (size_t i = 0; i < req_events.size(); ++i) {
         const auto &event = req_events[i];
 
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
         if (event == target_event && fd[event] != -1) {
+#else
+        // No counter is opened, requested events read 0.
+        if (event == target_event) {
+#endif
             return total_count[i];
         }
     }
@@ -234,8 +256,307 @@ uint64_t PerfStopwatch::get_counter(const Event target_event) const {
     throw std::runtime_error("PerfStopwatch: Trying to read a non tracked event");
 }
 
-const char *PerfStopwatch::get_descriptor(const Event target_event) {
-    return descriptors[target_event];
+std::vector<PerfStopwatch::Event> PerfStopwatch::get_events() const {
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+    std::vector<Event> events;
+
+    for (const auto &event : req_events) {
+        if (fd[event] != -1) {
+            events.push_back(event);
+        }
+    }
+
+    return events;
+#else
+    // No counter is opened, requested events read 0.
+    return req_events;
+#endif
+}
+
+void PerfStopwatch::get_counters(uint64_t *counters) const {
+    size_t counter = 0;
+
+    for (size_t i = 0; i < req_events.size(); ++i) {
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+        if (fd[req_events[i]] != -1) {
+            counters[counter++] = total_count[i];
+        }
+#else
+        // No counter is opened, requested events read 0.
+        counters[counter++] = total_count[i];
+#endif
+    }
+}
+
+void PerfStopwatch::trace(const std::string &region_name) {
+    std::vector<std::string> counter_names;
+
+    for (size_t i = 0; i < req_events.size() && i < Tracer::MAX_COUNTERS; ++i) {
+        counter_names.push_back(get_descriptor(req_events[i]));
+    }
+
+    trace_region = Tracer::register_region(region_name, counter_names);
+}
+
+void PerfStopwatch::publish(const std::string &region_name) {
+    std::vector<std::string> value_names;
+
+    for (size_t i = 0; i < req_events.size() && i < MetricRegistry::MAX_VALUES; ++i) {
+        value_names.push_back(get_descriptor(req_events[i]));
+    }
+
+    metric_slot = MetricRegistry::register_metric(region_name, value_names);
+}
+
+bool PerfStopwatch::add_trigger(const Event event, const uint64_t budget,
+                                TriggerCallback callback, void *arg) {
+    return arm_trigger(event, budget, callback, arg, nullptr);
+}
+
+bool PerfStopwatch::add_trigger(const Event event, const uint64_t budget, TriggerFlag *flag) {
+    return arm_trigger(event, budget, nullptr, nullptr, flag);
+}
+
+void PerfStopwatch::clear_triggers() {
+    for (const auto &slot : trigger_slots) {
+        Trigger &trigger = triggers[slot];
+        const int trigger_fd = trigger.fd.load();
+
+        ioctl(trigger_fd, PERF_EVENT_IOC_DISABLE, 0);
+
+        // Hide the slot from new handlers, then wait for the handlers of
+        // other threads that already hold the ring.
+        trigger.fd.store(-1);
+
+        while (trigger.in_handler.load() != 0) {
+            sched_yield();
+        }
+
+        munmap(trigger.ring, trigger.ring_size);
+        close(trigger_fd);
+
+        trigger.used.store(false);
+    }
+
+    trigger_slots.clear();
+}
+
+int PerfStopwatch::get_trigger_signal() {
+    return trigger_signal;
+}
+
+bool PerfStopwatch::arm_trigger(const Event event, const uint64_t budget,
+                                TriggerCallback callback, void *arg, TriggerFlag *flag) {
+#ifdef HPCTOOLS_DISABLE_INSTRUMENTATION
+    // Triggers need a counter, and no counter is opened.
+    (void)event;
+    (void)budget;
+    (void)callback;
+    (void)arg;
+    (void)flag;
+
+    return false;
+#else
+    static std::once_flag handler_installed;
+
+    if (budget == 0) {
+        print_error("%16s: ERROR trigger budget must be > 0.\n", descriptors[event]);
+        return false;
+    }
+
+    // Find a free slot.
+    int slot = 0;
+    bool expected = false;
+
+    while (slot < MAX_TRIGGERS && !triggers[slot].used.compare_exchange_strong(expected, true)) {
+        expected = false;
+        ++slot;
+    }
+
+    if (slot == MAX_TRIGGERS) {
+        print_error("%16s: ERROR too many triggers.\n", descriptors[event]);
+        return false;
+    }
+
+    Trigger &trigger = triggers[slot];
+
+    trigger.fd = -1;
+    trigger.event = event;
+    trigger.budget = budget;
+    trigger.tid = syscall(SYS_gettid);
+    trigger.callback = callback;
+    trigger.arg = arg;
+    trigger.flag = flag;
+
+    // Use the first real-time signal from SIGRTMIN + 3 that the program does
+    // not handle yet.
+    std::call_once(handler_installed, []() {
+        for (int sig = SIGRTMIN + 3; sig <= SIGRTMAX; ++sig) {
+            struct sigaction current;
+
+            if (sigaction(sig, nullptr, &current) != 0 ||
+                (current.sa_flags & SA_SIGINFO ? current.sa_sigaction != nullptr
+                                               : current.sa_handler != SIG_DFL)) {
+                continue;
+            }
+
+            struct sigaction action;
+
+            memset(&action, 0, sizeof(action));
+            action.sa_sigaction = trigger_handler;
+            action.sa_flags = SA_SIGINFO | SA_RESTART;
+            sigemptyset(&action.sa_mask);
+
+            if (sigaction(sig, &action, nullptr) == 0) {
+                trigger_signal = sig;
+                return;
+            }
+        }
+    });
+
+    if (trigger_signal == -1) {
+        print_error("%16s: ERROR no free real-time signal for the triggers.\n",
+                    descriptors[event]);
+        trigger.used.store(false);
+        return false;
+    }
+
+    // Sampling counter of the calling thread (not inherited, so that it can
+    // be mmapped), whose samples hold the IP and the thread.
+    struct perf_event_attr pe;
+
+    perf_struct(&pe, get_type(event), get_config(event));
+    pe.inherit = 0;
+    pe.sample_period = budget;
+    pe.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID;
+    pe.wakeup_events = 1;
+
+    int trigger_fd = perf_event_open(&pe, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+
+    // perf_event_paranoid may not allow counting in the kernel.
+    if (trigger_fd == -1 && !pe.exclude_kernel && (errno == EACCES || errno == EPERM)) {
+        pe.exclude_kernel = 1;
+        trigger_fd = perf_event_open(&pe, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+
+    if (trigger_fd == -1) {
+        print_error("%16s: ERROR opening trigger counter %s\n", descriptors[event],
+                    strerror(errno));
+        trigger.used.store(false);
+        return false;
+    }
+
+    // One metadata page and one data page.
+    trigger.ring_size = 2 * sysconf(_SC_PAGESIZE);
+    trigger.ring = (struct perf_event_mmap_page *)mmap(nullptr, trigger.ring_size,
+                                                      PROT_READ | PROT_WRITE, MAP_SHARED,
+                                                      trigger_fd, 0);
+
+    if (trigger.ring == MAP_FAILED) {
+        print_error("%16s: ERROR mapping trigger counter %s\n", descriptors[event],
+                    strerror(errno));
+        close(trigger_fd);
+        trigger.used.store(false);
+        return false;
+    }
+
+    // Deliver the overflows to the calling thread.
+    struct f_owner_ex owner;
+
+    owner.type = F_OWNER_TID;
+    owner.pid = trigger.tid;
+
+    if (fcntl(trigger_fd, F_SETFL, O_ASYNC) == -1 ||
+        fcntl(trigger_fd, F_SETSIG, trigger_signal) == -1 ||
+        fcntl(trigger_fd, F_SETOWN_EX, &owner) == -1) {
+
+        print_error("%16s: ERROR setting trigger signal %s\n", descriptors[event],
+                    strerror(errno));
+        munmap(trigger.ring, trigger.ring_size);
+        close(trigger_fd);
+        trigger.used.store(false);
+        return false;
+    }
+
+    trigger.fd = trigger_fd;
+    trigger_slots.push_back(slot);
+
+    return true;
+#endif
+}
+
+void PerfStopwatch::trigger_handler(int, siginfo_t *info, void *) {
+    const int saved_errno = errno;
+
+    for (int slot = 0; slot < MAX_TRIGGERS; ++slot) {
+        Trigger &trigger = triggers[slot];
+
+        if (!trigger.used.load() || trigger.fd.load() != info->si_fd) {
+            continue;
+        }
+
+        // Hold the slot, then check that clear_triggers() has not released
+        // it in the meantime.
+        trigger.in_handler.fetch_add(1);
+
+        if (trigger.fd.load() != info->si_fd) {
+            trigger.in_handler.fetch_sub(1);
+            continue;
+        }
+
+        // Fire once per interval.
+        ioctl(info->si_fd, PERF_EVENT_IOC_DISABLE, 0);
+
+        // Last sample of the ring: header, IP, PID and TID.
+        TriggerInfo fired = {trigger.event, trigger.budget, trigger.tid, 0};
+        bool sampled = false;
+
+        const uint64_t head = __atomic_load_n(&trigger.ring->data_head, __ATOMIC_ACQUIRE);
+        uint64_t tail = trigger.ring->data_tail;
+
+        while (tail < head) {
+            struct perf_event_header header;
+
+            ring_copy(trigger.ring, tail, &header, sizeof(header));
+
+            if (header.size == 0) {
+                break;
+            }
+
+            if (header.type == PERF_RECORD_SAMPLE) {
+                uint32_t pid_tid[2];
+
+                ring_copy(trigger.ring, tail + sizeof(header), &fired.ip, sizeof(fired.ip));
+                ring_copy(trigger.ring, tail + sizeof(header) + sizeof(fired.ip), pid_tid,
+                          sizeof(pid_tid));
+
+                fired.tid = pid_tid[1];
+                sampled = true;
+            }
+
+            tail += header.size;
+        }
+
+        __atomic_store_n(&trigger.ring->data_tail, head, __ATOMIC_RELEASE);
+
+        // The overflow also wakes up the ring, so a sample can raise several
+        // signals: only the first one finds it.
+        if (sampled) {
+            if (trigger.flag != nullptr) {
+                trigger.flag->ip.store(fired.ip);
+                trigger.flag->tid.store(fired.tid);
+                trigger.flag->fired.fetch_add(1, std::memory_order_release);
+            }
+
+            if (trigger.callback != nullptr) {
+                trigger.callback(fired, trigger.arg);
+            }
+        }
+
+        trigger.in_handler.fetch_sub(1);
+    }
+
+    errno = saved_errno;
 }
 
 int PerfStopwatch::perf_event_open(const struct perf_event_attr *const hw_event, const pid_t pid,
@@ -249,8 +570,9 @@ void PerfStopwatch::perf_struct(struct perf_event_attr *const pe, const int type
     pe->size = sizeof(struct perf_event_attr);
     pe->disabled = 1;
 
-    // Exclude kernel and hypervisor from being measured.
-    pe->exclude_kernel = 1;
+    // Exclude kernel and hypervisor from being measured. Software events
+    // (context switches, migrations...) only happen in the kernel.
+    pe->exclude_kernel = type != PERF_TYPE_SOFTWARE;
     pe->exclude_hv = 1;
 
     // Children inherit it
@@ -598,6 +920,13 @@ void PerfStopwatch::perf_start(const std::vector<Event> &req_events) {
 
             fd[event] = perf_event_open(&pe[event], 0, -1, -1, 0);
 
+            // perf_event_paranoid may not allow counting in the kernel.
+            if (fd[event] == -1 && !pe[event].exclude_kernel &&
+                (errno == EACCES || errno == EPERM)) {
+                pe[event].exclude_kernel = 1;
+                fd[event] = perf_event_open(&pe[event], 0, -1, -1, 0);
+            }
+
             if (fd[event] == -1) {
                 print_error("Error opening event %llx (%s) %s\n",
                             pe[event].config, descriptors[event], strerror(errno));
@@ -1,7 +1,14 @@
 #pragma once
 
+#include "../MetricRegistry/MetricRegistry.h"
+#include "../Tracer/Tracer.h"
+
+#include <linux/perf_event.h>
+#include <signal.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <atomic>
+#include <string>
 #include <vector>
 
 /**
@@ -14,6 +21,20 @@
  *
  * Warning: In order to tracks events for every thread, the main thread must
  * be the one controlling the stopwatch.
+ *
+ * With -DHPCTOOLS_DISABLE_INSTRUMENTATION no counter is opened, play() and
+ * pause() do nothing and the requested events read 0 (see PerfStopwatchT).
+ *
+ * Triggers (see add_trigger()) react when a play()/pause() interval exceeds
+ * a budget of an event, e.g. 10^10 cycles or 100 major page faults. Each
+ * trigger is a sampling counter of the thread that adds it, whose period is
+ * the budget. The period is reset and the counter enabled on every play(),
+ * so it overflows once the interval has used the whole budget. The overflow
+ * raises a real-time signal in that thread (O_ASYNC, F_SETSIG and
+ * F_SETOWN_EX), and the handler reads the IP and the thread of the overflow
+ * sample from the mmap ring of the counter. A trigger fires at most once per
+ * interval. The signal is the first real-time signal from SIGRTMIN + 3 that
+ * has no handler when the first trigger is armed (see get_trigger_signal()).
  */
 
 class PerfStopwatch {
@@ -93,6 +114,29 @@ public:
         NUM_EVENTS
     };
 
+    // A fired trigger.
+    struct TriggerInfo {
+        Event event;     // Event that exceeded its budget.
+        uint64_t budget; // Budget of the event.
+        pid_t tid;       // Thread that exceeded it.
+        uint64_t ip;     // Instruction pointer of the overflow (0 if unknown).
+    };
+
+    // Trigger callback, it runs in a signal handler, so it must be
+    // async-signal-safe (no malloc, printf, locks...).
+    typedef void (*TriggerCallback)(const TriggerInfo &info, void *arg);
+
+    // A flag that a watcher thread can poll. ip and tid are the ones of the
+    // last firing.
+    struct TriggerFlag {
+        std::atomic<uint64_t> fired{0}; // Times the trigger has fired.
+        std::atomic<uint64_t> ip{0};
+        std::atomic<pid_t> tid{0};
+    };
+
+    // Max. triggers armed at once in the process, shared by every stopwatch.
+    static const int MAX_TRIGGERS = 64;
+
     PerfStopwatch() = delete; // No default constructor allowed.
 
     /**
@@ -148,13 +192,21 @@ public:
      * Start counting HW events.
      *
      */
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
     void play();
+#else
+    void play() {}
+#endif
 
     /**
      * Stop counting HW events.
      *
      */
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
     void pause();
+#else
+    void pause() {}
+#endif
 
     /**
      * Print the counter of every tracked event into stdout.
@@ -172,14 +224,141 @@ public:
      */
     uint64_t get_counter(const Event target_event) const;
 
+    /**
+     * Get the events being counted (requested and successfully opened), whose
+     * counters can be read with get_counter(). With
+     * -DHPCTOOLS_DISABLE_INSTRUMENTATION, the requested events (they read 0).
+     *
+     */
+    std::vector<Event> get_events() const;
+
+    /**
+     * Get the counters of the events of get_events(), in the same order,
+     * without allocating or looking the events up. For readers that poll the
+     * counters often.
+     *
+     * @param counters Array of get_events().size() elements.
+     */
+    void get_counters(uint64_t *counters) const;
+
     /**
      * Get the event descriptor referred by EVENT.
      *
      * @param target_event event reference.
      * @return const char* (event descriptor).
      */
-    static const char *get_descriptor(const Event target_event);
+    static constexpr const char *get_descriptor(const Event target_event) {
+        return descriptors[target_event];
+    }
+
+    /**
+     * Type of an event (see perf_event_attr man).
+     *
+     */
+    static constexpr uint32_t get_type(const Event event) {
+        return event < L1D_READ_ACCESS ? PERF_TYPE_HARDWARE
+               : event < CPU_CLOCK     ? PERF_TYPE_HW_CACHE
+                                       : PERF_TYPE_SOFTWARE;
+    }
+
+    /**
+     * Config of an event (see perf_event_attr man). The Event enum follows the
+     * order of the perf hardware, cache and software event IDs.
+     *
+     */
+    static constexpr uint64_t get_config(const Event event) {
+        return event < L1D_READ_ACCESS
+                   ? (uint64_t)event
+               : event < CPU_CLOCK
+                   // 7 caches per block, blocks are read/write/prefetch x access/miss.
+                   ? (uint64_t)((event - L1D_READ_ACCESS) % 7) |
+                         ((uint64_t)((event - L1D_READ_ACCESS) / 14) << 8) |
+                         ((uint64_t)(((event - L1D_READ_ACCESS) / 7) % 2) << 16)
+                   : (uint64_t)(event - CPU_CLOCK);
+    }
+
+    /**
+     * Record every play() and pause() in the trace of Tracer as an enter and
+     * an exit of a region. The exit records carry the deltas of the first
+     * Tracer::MAX_COUNTERS requested events.
+     *
+     * @param region_name Name of the region.
+     */
+    void trace(const std::string &region_name);
+
+    /**
+     * Publish the counters of the first MetricRegistry::MAX_VALUES requested
+     * events into MetricRegistry on every pause(), so they can be monitored
+     * with hpcmon.
+     *
+     * A slot must have a single writer, so copies of the stopwatch are not
+     * published (call publish() on them with their own region name).
+     *
+     * @param region_name Name of the region.
+     */
+    void publish(const std::string &region_name);
+
+    /**
+     * Call CALLBACK when a play()/pause() interval of the calling thread
+     * exceeds BUDGET occurrences of EVENT. Every thread to watch must add
+     * its own trigger. Triggers are not copied with the stopwatch.
+     *
+     * At most MAX_TRIGGERS triggers can be armed at once in the whole process
+     * (every thread of every stopwatch), further calls fail until a
+     * stopwatch holding triggers calls clear_triggers() or is destroyed.
+     *
+     * @param event Event to watch.
+     * @param budget Max. occurrences of the event per interval.
+     * @param callback Async-signal-safe function called by the signal handler.
+     * @param arg Argument of the callback.
+     * @return true if the trigger has been armed, false otherwise.
+     */
+    bool add_trigger(const Event event, const uint64_t budget, TriggerCallback callback,
+                     void *arg = nullptr);
+
+    /**
+     * Update FLAG when a play()/pause() interval of the calling thread
+     * exceeds BUDGET occurrences of EVENT (see add_trigger()).
+     *
+     * @param event Event to watch.
+     * @param budget Max. occurrences of the event per interval.
+     * @param flag Flag to update, it must outlive the stopwatch.
+     * @return true if the trigger has been armed, false otherwise.
+     */
+    bool add_trigger(const Event event, const uint64_t budget, TriggerFlag *flag);
+
+    /**
+     * Disarm and remove every trigger of the stopwatch. Waits for the signal
+     * handlers that are using them to finish.
+     *
+     */
+    void clear_triggers();
+
+    /**
+     * Get the signal raised by the triggers.
+     *
+     * @return int signal number, -1 if no trigger has been armed yet.
+     */
+    static int get_trigger_signal();
 private:
+    // An armed trigger (see add_trigger()).
+    struct Trigger {
+        std::atomic<bool> used;       // The slot is in use.
+        std::atomic<int> fd;          // Sampling counter, -1 if it is being set up or released.
+        std::atomic<int> in_handler;  // Signal handlers using the slot.
+        Event event;
+        uint64_t budget;
+        pid_t tid;
+        TriggerCallback callback;
+        void *arg;
+        TriggerFlag *flag;
+        struct perf_event_mmap_page *ring; // Sample ring buffer.
+        size_t ring_size;
+    };
+
+    // Triggers of every stopwatch of the process, looked up by the signal handler.
+    static Trigger triggers[MAX_TRIGGERS];
+
     // File descriptor used by perf.
     static int fd[NUM_EVENTS];
 
@@ -187,13 +366,89 @@ private:
     static unsigned int tracked_events[NUM_EVENTS];
 
     // Event description.
-    static const char *descriptors[NUM_EVENTS];
+    static constexpr const char *descriptors[NUM_EVENTS] = {
+        "cpu cycles",
+        "instructions",
+        "cache references",
+        "cache misses",
+        "branch instructions",
+        "branch misses",
+        "bus cycles",
+        "stalled cycles frontend",
+        "stalled cycles backend",
+        "ref cpu cycles",
+
+        "L1D read access",
+        "L1I read access",
+        "LL read access",
+        "DTLB read access",
+        "ITLB read access",
+        "BPU read access",
+        "NODE read access",
+
+        "L1D read misses",
+        "L1I read misses",
+        "LL read misses",
+        "DTLB read misses",
+        "ITLB read misses",
+        "BPU read misses",
+        "NODE read misses",
+
+        "L1D write access",
+        "L1I write access",
+        "LL write access",
+        "DTLB write access",
+        "ITLB write access",
+        "BPU write access",
+        "NODE write access",
+
+        "L1D write misses",
+        "L1I write misses",
+        "LL write misses",
+        "DTLB write misses",
+        "ITLB write misses",
+        "BPU write misses",
+        "NODE write misses",
+
+        "L1D prefetch access",
+        "L1I prefetch access",
+        "LL prefetch access",
+        "DTLB prefetch access",
+        "ITLB prefetch access",
+        "BPU prefetch access",
+        "NODE prefetch access",
+
+        "L1D prefetch misses",
+        "L1I prefetch misses",
+        "LL prefetch misses",
+        "DTLB prefetch misses",
+        "ITLB prefetch misses",
+        "BPU prefetch misses",
+        "NODE prefetch misses",
+
+        "cpu clock",
+        "task clock",
+        "page faults",
+        "context switches",
+        "cpu migrations",
+        "page faults min",
+        "page faults maj",
+        "alignment faults",
+        "emulation faults",
+        "dummy",
+        "bpf output",
+    };
 
     std::vector<Event> req_events; // Events being tracked.
 
     std::vector<uint64_t> start_count; // HW counters on play time.
     std::vector<uint64_t> total_count; // Total count between plays and stops.
 
+    uint32_t trace_region; // Tracer region, Tracer::NO_REGION if not traced.
+    uint32_t metric_slot;  // MetricRegistry slot, MetricRegistry::NO_SLOT if not published.
+
+    std::vector<int> trigger_slots; // Triggers of this stopwatch.
+
     /**
      * Creates a file descriptor that allows measuring performance information.
      * Each file descriptor corresponds to one event that is measured; these can
@@ -283,4 +538,18 @@ private:
      *
      */
     void perf_start(const std::vector<Event> &req_events);
-};
\ No newline at end of file
+
+    /**
+     * Arm a trigger of the calling thread.
+     *
+     * @return true if the trigger has been armed, false otherwise.
+     */
+    bool arm_trigger(const Event event, const uint64_t budget, TriggerCallback callback,
+                     void *arg, TriggerFlag *flag);
+
+    /**
+     * Handler of the overflow signal of the triggers.
+     *
+     */
+    static void trigger_handler(int signum, siginfo_t *info, void *context);
+};
@@ -0,0 +1,328 @@
+#pragma once
+
+#include "PerfStopwatch.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+
+/**
+ * @author Lorién López Villellas (lorien.lopez@bsc.es)
+ *
+ * A PerfStopwatch whose events are fixed at compile time:
+ *
+ *    PerfStopwatchT<PerfStopwatch::CPU_CYCLES,
+ *                   PerfStopwatch::INSTRUCTIONS,
+ *                   PerfStopwatch::LL_READ_MISSES> stopwatch;
+ *
+ * Counters are stored in fixed-size arrays and the events are opened as a
+ * perf group, so play() and pause() read every counter with a single read(2)
+ * without allocating memory or looking up the requested events at runtime.
+ * A group is scheduled onto the CPU as a unit, so do not request more
+ * hardware events than hardware counters has the CPU.
+ *
+ * Building with -DHPCTOOLS_DISABLE_INSTRUMENTATION turns every
+ * PerfStopwatchT into an empty object whose member functions do nothing, so
+ * instrumentation can be left in production builds for free. The switch
+ * covers every stopwatch of HPC-Tools (PerfStopwatch, TimeStopwatch,
+ * PresetStopwatch, EnergyStopwatch, OffCpuStopwatch, SampledStopwatch,
+ * MemSampler, NumaReport), Tracer and MetricRegistry: no counter is opened,
+ * play()/pause() are inline no-ops and the getters return 0 for whatever was
+ * requested (events, presets, domains...) instead of throwing. Tools that
+ * need real measurements (cachebench, ABCompare) refuse to build with it.
+ *
+ * Warning: In order to tracks events for every thread, the main thread must
+ * be the one controlling the stopwatch.
+ */
+
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+
+#include "printer.h"
+
+#include <asm/unistd.h>
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <stdexcept>
+
+template <PerfStopwatch::Event... Events>
+class PerfStopwatchT {
+public:
+    static constexpr size_t NUM_REQ_EVENTS = sizeof...(Events);
+
+    static_assert(NUM_REQ_EVENTS > 0, "PerfStopwatchT: At least one event is required");
+
+    /**
+     * Initializes the stopwatch. Also performs a restart().
+     *
+     */
+    PerfStopwatchT() {
+        perf_start();
+        restart();
+    }
+
+    PerfStopwatchT(const PerfStopwatchT &other) = delete;
+    PerfStopwatchT &operator=(const PerfStopwatchT &other) = delete;
+
+    /**
+     * Destroys the stopwatch.
+     *
+     */
+    ~PerfStopwatchT() {
+        if (fd[0] != -1) {
+            ioctl(fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        }
+
+        for (size_t i = 0; i < NUM_REQ_EVENTS; ++i) {
+            if (fd[i] != -1) {
+                close(fd[i]);
+            }
+        }
+    }
+
+    /**
+     * Restarts the stopwatch counters.
+     *
+     */
+    void restart() {
+        total_count.fill(0);
+    }
+
+    /**
+     * Start counting HW events.
+     *
+     */
+    void play() {
+        read_group(start_count);
+    }
+
+    /**
+     * Stop counting HW events.
+     *
+     */
+    void pause() {
+        std::array<uint64_t, NUM_REQ_EVENTS> stop_count;
+
+        if (read_group(stop_count)) {
+            for (size_t i = 0; i < NUM_REQ_EVENTS; ++i) {
+                total_count[i] += stop_count[i] - start_count[i];
+            }
+        }
+    }
+
+    /**
+     * Print the counter of every tracked event into stdout.
+     *
+     */
+    void print_all_counters() const {
+        for (size_t i = 0; i < NUM_REQ_EVENTS; ++i) {
+            if (fd[i] != -1) {
+                printf("%16s: %14lu\n", get_descriptor(events[i]), total_count[i]);
+            }
+        }
+    }
+
+    /**
+     * Get the counter of EVENT. Fails to compile if the stopwatch is not
+     * tracking the event.
+     *
+     */
+    template <PerfStopwatch::Event target_event>
+    uint64_t get_counter() const {
+        static_assert(index_of(target_event) < NUM_REQ_EVENTS,
+                      "PerfStopwatchT: Trying to read a non tracked event");
+
+        return total_count[index_of(target_event)];
+    }
+
+    /**
+     * Get the counter of EVENT.
+     *
+     * If the stopwatch is not tracking the target event, the function
+     * will throw an exception.
+     *
+     * @param target_event event reference.
+     */
+    uint64_t get_counter(const PerfStopwatch::Event target_event) const {
+        const size_t i = index_of(target_event);
+
+        if (i == NUM_REQ_EVENTS || fd[i] == -1) {
+            throw std::runtime_error("PerfStopwatchT: Trying to read a non tracked event");
+        }
+
+        return total_count[i];
+    }
+
+    /**
+     * Get the event descriptor referred by EVENT.
+     *
+     * @param target_event event reference.
+     * @return const char* (event descriptor).
+     */
+    static constexpr const char *get_descriptor(const PerfStopwatch::Event target_event) {
+        return PerfStopwatch::get_descriptor(target_event);
+    }
+
+private:
+    static constexpr PerfStopwatch::Event events[NUM_REQ_EVENTS] = {Events...};
+
+    std::array<int, NUM_REQ_EVENTS> fd;          // File descriptor of each event, fd[0] leads the group.
+    std::array<size_t, NUM_REQ_EVENTS> position; // Position of each event in the group.
+    size_t group_size;                           // Events opened.
+
+    std::array<uint64_t, NUM_REQ_EVENTS> start_count; // HW counters on play time.
+    std::array<uint64_t, NUM_REQ_EVENTS> total_count; // Total count between plays and stops.
+
+    /**
+     * Position of an event in the requested events, NUM_REQ_EVENTS if the event
+     * is not requested.
+     *
+     */
+    static constexpr size_t index_of(const PerfStopwatch::Event target_event, const size_t i = 0) {
+        return i == NUM_REQ_EVENTS       ? NUM_REQ_EVENTS
+               : events[i] == target_event ? i
+                                         : index_of(target_event, i + 1);
+    }
+
+    /**
+     * Open the requested events as a group and start counting.
+     *
+     */
+    void perf_start() {
+        group_size = 0;
+
+        for (size_t i = 0; i < NUM_REQ_EVENTS; ++i) {
+            struct perf_event_attr pe;
+
+            memset(&pe, 0, sizeof(struct perf_event_attr));
+            pe.size = sizeof(struct perf_event_attr);
+            pe.disabled = i == 0; // Only the leader.
+
+            // Type of event to measure.
+            pe.type = PerfStopwatch::get_type(events[i]);
+            pe.config = PerfStopwatch::get_config(events[i]);
+
+            // Exclude kernel and hypervisor from being measured. Software
+            // events (context switches, migrations...) only happen in the
+            // kernel.
+            pe.exclude_kernel = pe.type != PERF_TYPE_SOFTWARE;
+            pe.exclude_hv = 1;
+
+            // Children inherit it
+            pe.inherit = 1;
+
+            // Read every member of the group at once.
+            pe.read_format = PERF_FORMAT_GROUP;
+
+            fd[i] = syscall(__NR_perf_event_open, &pe, 0, -1, i == 0 ? -1 : fd[0], 0);
+
+            // perf_event_paranoid may not allow counting in the kernel.
+            if (fd[i] == -1 && !pe.exclude_kernel && (errno == EACCES || errno == EPERM)) {
+                pe.exclude_kernel = 1;
+                fd[i] = syscall(__NR_perf_event_open, &pe, 0, -1, i == 0 ? -1 : fd[0], 0);
+            }
+
+            if (fd[i] == -1) {
+                print_error("Error opening event %llx (%s) %s\n",
+                            pe.config, get_descriptor(events[i]), strerror(errno));
+
+                if (i == 0) {
+                    // Without a leader there is no group.
+                    for (size_t j = 1; j < NUM_REQ_EVENTS; ++j) {
+                        fd[j] = -1;
+                    }
+                    return;
+                }
+            }
+            else {
+                position[i] = group_size++;
+            }
+        }
+
+        ioctl(fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    /**
+     * Read every counter of the group.
+     *
+     * @return true on success, false otherwise.
+     */
+    bool read_group(std::array<uint64_t, NUM_REQ_EVENTS> &count) const {
+        if (fd[0] == -1) {
+            return false;
+        }
+
+        // nr followed by the value of each member.
+        uint64_t values[1 + NUM_REQ_EVENTS];
+        const ssize_t size = (1 + group_size) * sizeof(uint64_t);
+
+        if (size != read(fd[0], values, size)) {
+            print_error("%16s: ERROR reading perf event.\n", get_descriptor(events[0]));
+            return false;
+        }
+
+        for (size_t i = 0; i < NUM_REQ_EVENTS; ++i) {
+            count[i] = fd[i] == -1 ? 0 : values[1 + position[i]];
+        }
+
+        return true;
+    }
+};
+
+template <PerfStopwatch::Event... Events>
+constexpr PerfStopwatch::Event PerfStopwatchT<Events...>::events[];
+
+#else // HPCTOOLS_DISABLE_INSTRUMENTATION
+
+template <PerfStopwatch::Event... Events>
+class PerfStopwatchT {
+public:
+    static constexpr size_t NUM_REQ_EVENTS = sizeof...(Events);
+
+    static_assert(NUM_REQ_EVENTS > 0, "PerfStopwatchT: At least one event is required");
+
+    void restart() {}
+    void play() {}
+    void pause() {}
+    void print_all_counters() const {}
+
+    template <PerfStopwatch::Event target_event>
+    uint64_t get_counter() const {
+        static_assert(index_of(target_event) < NUM_REQ_EVENTS,
+                      "PerfStopwatchT: Trying to read a non tracked event");
+
+        return 0;
+    }
+
+    uint64_t get_counter(const PerfStopwatch::Event) const {
+        return 0;
+    }
+
+    static constexpr const char *get_descriptor(const PerfStopwatch::Event target_event) {
+        return PerfStopwatch::get_descriptor(target_event);
+    }
+
+private:
+    static constexpr PerfStopwatch::Event events[] = {Events...};
+
+    /**
+     * Position of an event in the requested events, NUM_REQ_EVENTS if the event
+     * is not requested. Also checked when disabled, so code that does not
+     * compile with instrumentation does not compile without it either.
+     *
+     */
+    static constexpr size_t index_of(const PerfStopwatch::Event target_event, const size_t i = 0) {
+        return i == NUM_REQ_EVENTS       ? NUM_REQ_EVENTS
+               : events[i] == target_event ? i
+                                         : index_of(target_event, i + 1);
+    }
+};
+
+template <PerfStopwatch::Event... Events>
+constexpr PerfStopwatch::Event PerfStopwatchT<Events...>::events[];
+
+#endif // HPCTOOLS_DISABLE_INSTRUMENTATION
@@ -0,0 +1,588 @@
+#define _GNU_SOURCE 1
+
+#include "PresetStopwatch.h"
+
+#include "printer.h"
+
+#include <asm/unistd.h>
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/utsname.h>
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+// Preset names.
+const char *PresetStopwatch::names[NUM_PRESETS] = {
+    "PAPI_TOT_CYC",
+    "PAPI_TOT_INS",
+    "PAPI_REF_CYC",
+    "PAPI_BR_INS",
+    "PAPI_BR_MSP",
+    "PAPI_L1_DCA",
+    "PAPI_L1_DCM",
+    "PAPI_L1_ICM",
+    "PAPI_L2_DCM",
+    "PAPI_L3_TCM",
+    "PAPI_TLB_DM",
+    "PAPI_TLB_IM",
+    "PAPI_FP_OPS",
+    "PAPI_SP_OPS",
+    "PAPI_DP_OPS",
+};
+
+// Preset description.
+const char *PresetStopwatch::descriptors[NUM_PRESETS] = {
+    "total cycles",
+    "instructions",
+    "reference cycles",
+    "branch instructions",
+    "branch mispredictions",
+    "L1D accesses",
+    "L1D misses",
+    "L1I misses",
+    "L2D misses",
+    "L3 misses",
+    "DTLB misses",
+    "ITLB misses",
+    "FP operations",
+    "SP FP operations",
+    "DP FP operations",
+};
+
+// CPU names.
+const char *PresetStopwatch::cpu_names[NUM_CPUS] = {
+    "generic",
+    "Intel",
+    "AMD",
+    "A64FX",
+    "Arm",
+};
+
+// Generic cache event configuration.
+#define HW_CACHE(cache, op, result) \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+// Intel FP_ARITH_INST_RETIRED event with the given umask.
+#define INTEL_FP_ARITH(umask) (0xc7 | ((umask) << 8))
+
+/**
+ * Whether the running kernel is at least MAJOR.MINOR.
+ *
+ */
+static bool kernel_at_least(const int major, const int minor) {
+    struct utsname name;
+    int kmajor = 0;
+    int kminor = 0;
+
+    if (uname(&name) != 0 || sscanf(name.release, "%d.%d", &kmajor, &kminor) != 2) {
+        return false;
+    }
+
+    return kmajor > major || (kmajor == major && kminor >= minor);
+}
+
+/**
+ * Read /proc/cpuinfo to find the CPU of the node.
+ *
+ */
+static PresetStopwatch::Cpu read_cpuinfo() {
+    PresetStopwatch::Cpu cpu = PresetStopwatch::CPU_GENERIC;
+
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+
+    bool fujitsu = false;
+    bool arm = false;
+
+    while (std::getline(cpuinfo, line)) {
+        if (line.find("GenuineIntel") != std::string::npos) {
+            cpu = PresetStopwatch::CPU_INTEL;
+            break;
+        }
+        if (line.find("AuthenticAMD") != std::string::npos) {
+            cpu = PresetStopwatch::CPU_AMD;
+            break;
+        }
+        if (line.compare(0, 15, "CPU implementer") == 0) {
+            arm = true;
+            fujitsu = fujitsu || line.find("0x46") != std::string::npos;
+        }
+        if (line.compare(0, 8, "CPU part") == 0 && fujitsu &&
+            line.find("0x001") != std::string::npos) {
+            cpu = PresetStopwatch::CPU_A64FX;
+            break;
+        }
+    }
+
+    if (cpu == PresetStopwatch::CPU_GENERIC && arm) {
+        cpu = PresetStopwatch::CPU_ARM;
+    }
+
+    return cpu;
+}
+
+PresetStopwatch::PresetStopwatch(const std::vector<Preset> &req_presets_) :
+    req_presets(req_presets_) {
+
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+    const Cpu cpu = detect_cpu();
+
+    // Check every preset before opening any counter.
+    const auto unsupported = get_unsupported(req_presets);
+
+    if (!unsupported.empty()) {
+        std::string msg = "PresetStopwatch: Unsupported presets on ";
+        msg += cpu_names[cpu];
+        msg += " CPU:";
+
+        for (const auto &preset : unsupported) {
+            msg += " ";
+            msg += names[preset];
+        }
+
+        throw std::runtime_error(msg);
+    }
+
+    for (const auto &preset : req_presets) {
+        first_native.push_back(natives.size());
+
+        for (const auto &native : get_natives(preset, cpu)) {
+            natives.push_back(native);
+        }
+    }
+    first_native.push_back(natives.size());
+
+    fd.assign(natives.size(), -1);
+
+    for (size_t i = 0; i < req_presets.size(); ++i) {
+        const std::vector<Native> preset_natives(natives.begin() + first_native[i],
+                                                 natives.begin() + first_native[i + 1]);
+        size_t member = first_native[i];
+
+        for (const auto &group : split_groups(preset_natives)) {
+            std::vector<int> group_fd;
+
+            first_member.push_back(member);
+            group_preset.push_back(i);
+
+            if (!open_group(group, group_fd)) {
+                print_error("Error opening the native events of %s %s\n",
+                            names[req_presets[i]], strerror(errno));
+            }
+            else {
+                std::copy(group_fd.begin(), group_fd.end(), fd.begin() + member);
+
+                ioctl(group_fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+                ioctl(group_fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            }
+
+            member += group.size();
+        }
+    }
+    first_member.push_back(natives.size());
+#else
+    // No native event, every preset reads 0.
+    first_native.assign(req_presets.size() + 1, 0);
+    first_member.assign(1, 0);
+#endif
+
+    start_count.resize(natives.size());
+    total_count.resize(natives.size());
+    start_enabled.resize(first_member.size() - 1);
+    start_running.resize(first_member.size() - 1);
+
+    restart();
+}
+
+PresetStopwatch::~PresetStopwatch() {
+    for (const auto &native_fd : fd) {
+        if (native_fd != -1) {
+            ioctl(native_fd, PERF_EVENT_IOC_DISABLE, 0);
+            close(native_fd);
+        }
+    }
+}
+
+void PresetStopwatch::restart() {
+    for (auto &count : total_count) {
+        count = 0;
+    }
+}
+
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+void PresetStopwatch::play() {
+    for (size_t g = 0; g + 1 < first_member.size(); ++g) {
+        read_group(g, &start_count[first_member[g]], start_enabled[g], start_running[g]);
+    }
+}
+
+void PresetStopwatch::pause() {
+    std::vector<uint64_t> stop_count(natives.size());
+
+    for (size_t g = 0; g + 1 < first_member.size(); ++g) {
+        uint64_t stop_enabled;
+        uint64_t stop_running;
+
+        if (!read_group(g, &stop_count[first_member[g]], stop_enabled, stop_running)) {
+            continue;
+        }
+
+        const uint64_t enabled = stop_enabled - start_enabled[g];
+        const uint64_t running = stop_running - start_running[g];
+
+        // The group has not been on the PMU, nothing can be estimated.
+        if (running == 0) {
+            continue;
+        }
+
+        // The kernel multiplexed the group with others, scale the counts.
+        const double scale = (double)enabled / running;
+
+        for (size_t j = first_member[g]; j < first_member[g + 1]; ++j) {
+            total_count[j] += (stop_count[j] - start_count[j]) * scale;
+        }
+    }
+}
+
+bool PresetStopwatch::read_group(const size_t group, uint64_t *values, uint64_t &enabled,
+                                 uint64_t &running) const {
+    const size_t first = first_member[group];
+    const size_t group_size = first_member[group + 1] - first;
+
+    if (group_size == 0 || fd[first] == -1) {
+        return false;
+    }
+
+    // nr, time enabled, time running and the value of each member.
+    std::vector<uint64_t> buffer(3 + group_size);
+    const ssize_t size = buffer.size() * sizeof(uint64_t);
+
+    if (size != read(fd[first], buffer.data(), size)) {
+        print_error("%16s: ERROR reading perf event.\n", names[req_presets[group_preset[group]]]);
+        return false;
+    }
+
+    enabled = buffer[1];
+    running = buffer[2];
+
+    for (size_t j = 0; j < group_size; ++j) {
+        values[j] = buffer[3 + j];
+    }
+
+    return true;
+}
+#endif
+
+void PresetStopwatch::print_all_counters() const {
+    for (const auto &preset : req_presets) {
+        printf("%16s: %14lu\n", names[preset], get_counter(preset));
+    }
+}
+
+uint64_t PresetStopwatch::get_counter(const Preset target_preset) const {
+    for (size_t i = 0; i < req_presets.size(); ++i) {
+        if (req_presets[i] != target_preset) {
+            continue;
+        }
+
+        double count = 0;
+        for (size_t j = first_native[i]; j < first_native[i + 1]; ++j) {
+            count += natives[j].weight * total_count[j];
+        }
+
+        return count < 0 ? 0 : (uint64_t)(count + 0.5);
+    }
+
+    throw std::runtime_error("PresetStopwatch: Trying to read a non tracked preset");
+}
+
+const char *PresetStopwatch::get_name(const Preset target_preset) {
+    return names[target_preset];
+}
+
+const char *PresetStopwatch::get_descriptor(const Preset target_preset) {
+    return descriptors[target_preset];
+}
+
+PresetStopwatch::Cpu PresetStopwatch::detect_cpu() {
+    // Initialized once, even if several threads build stopwatches at once.
+    static const Cpu cpu = read_cpuinfo();
+
+    return cpu;
+}
+
+std::vector<PresetStopwatch::Preset>
+PresetStopwatch::get_unsupported(const std::vector<Preset> &presets) {
+    const Cpu cpu = detect_cpu();
+
+    std::vector<Preset> unsupported;
+
+    for (const auto &preset : presets) {
+        const auto preset_natives = get_natives(preset, cpu);
+
+        bool supported = !preset_natives.empty();
+
+        // Probe the groups, they are never enabled. The kernel refuses
+        // groups that can never be scheduled on the PMU.
+        for (const auto &group : split_groups(preset_natives)) {
+            std::vector<int> group_fd;
+
+            supported = supported && open_group(group, group_fd);
+
+            for (const auto &native_fd : group_fd) {
+                close(native_fd);
+            }
+        }
+
+        if (!supported) {
+            unsupported.push_back(preset);
+        }
+    }
+
+    return unsupported;
+}
+
+std::vector<PresetStopwatch::Native>
+PresetStopwatch::get_natives(const Preset preset, const Cpu cpu) {
+    const bool x86 = cpu == CPU_INTEL || cpu == CPU_AMD;
+    const bool arm = cpu == CPU_A64FX || cpu == CPU_ARM;
+
+    switch (preset) {
+    case PAPI_TOT_CYC:
+        return {{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 1}};
+
+    case PAPI_TOT_INS:
+        return {{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 1}};
+
+    case PAPI_REF_CYC:
+        if (x86) {
+            return {{PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES, 1}};
+        }
+        return {};
+
+    case PAPI_BR_INS:
+        if (arm) {
+            // BR_RETIRED (the generic event counts every PC write).
+            return {{PERF_TYPE_RAW, 0x21, 1}};
+        }
+        return {{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, 1}};
+
+    case PAPI_BR_MSP:
+        if (arm) {
+            // BR_MIS_PRED.
+            return {{PERF_TYPE_RAW, 0x10, 1}};
+        }
+        return {{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, 1}};
+
+    case PAPI_L1_DCA:
+        if (arm) {
+            // L1D_CACHE.
+            return {{PERF_TYPE_RAW, 0x04, 1}};
+        }
+        if (cpu == CPU_INTEL) {
+            return {
+                {PERF_TYPE_HW_CACHE,
+                 HW_CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+                          PERF_COUNT_HW_CACHE_RESULT_ACCESS), 1},
+                {PERF_TYPE_HW_CACHE,
+                 HW_CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_WRITE,
+                          PERF_COUNT_HW_CACHE_RESULT_ACCESS), 1},
+            };
+        }
+        return {{PERF_TYPE_HW_CACHE,
+                 HW_CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+                          PERF_COUNT_HW_CACHE_RESULT_ACCESS), 1}};
+
+    case PAPI_L1_DCM:
+        if (arm) {
+            // L1D_CACHE_REFILL.
+            return {{PERF_TYPE_RAW, 0x03, 1}};
+        }
+        if (cpu == CPU_INTEL) {
+            // L1D.REPLACEMENT, counts load and store misses.
+            return {{PERF_TYPE_RAW, 0x0151, 1}};
+        }
+        return {{PERF_TYPE_HW_CACHE,
+                 HW_CACHE(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+                          PERF_COUNT_HW_CACHE_RESULT_MISS), 1}};
+
+    case PAPI_L1_ICM:
+        if (arm) {
+            // L1I_CACHE_REFILL.
+            return {{PERF_TYPE_RAW, 0x01, 1}};
+        }
+        return {{PERF_TYPE_HW_CACHE,
+                 HW_CACHE(PERF_COUNT_HW_CACHE_L1I, PERF_COUNT_HW_CACHE_OP_READ,
+                          PERF_COUNT_HW_CACHE_RESULT_MISS), 1}};
+
+    case PAPI_L2_DCM:
+        if (arm) {
+            // L2D_CACHE_REFILL.
+            return {{PERF_TYPE_RAW, 0x17, 1}};
+        }
+        if (cpu == CPU_INTEL) {
+            // L2_RQSTS.DEMAND_DATA_RD_MISS.
+            return {{PERF_TYPE_RAW, 0x2124, 1}};
+        }
+        return {};
+
+    case PAPI_L3_TCM:
+        if (cpu == CPU_INTEL) {
+            // LONGEST_LAT_CACHE.MISS.
+            return {{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, 1}};
+        }
+        // A64FX has no L3, AMD L3 events live in a different PMU.
+        return {};
+
+    case PAPI_TLB_DM:
+        if (arm) {
+            // L1D_TLB_REFILL.
+            return {{PERF_TYPE_RAW, 0x05, 1}};
+        }
+        if (cpu == CPU_INTEL) {
+            return {
+                {PERF_TYPE_HW_CACHE,
+                 HW_CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+                          PERF_COUNT_HW_CACHE_RESULT_MISS), 1},
+                {PERF_TYPE_HW_CACHE,
+                 HW_CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_WRITE,
+                          PERF_COUNT_HW_CACHE_RESULT_MISS), 1},
+            };
+        }
+        return {{PERF_TYPE_HW_CACHE,
+                 HW_CACHE(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+                          PERF_COUNT_HW_CACHE_RESULT_MISS), 1}};
+
+    case PAPI_TLB_IM:
+        if (arm) {
+            // L1I_TLB_REFILL.
+            return {{PERF_TYPE_RAW, 0x02, 1}};
+        }
+        return {{PERF_TYPE_HW_CACHE,
+                 HW_CACHE(PERF_COUNT_HW_CACHE_ITLB, PERF_COUNT_HW_CACHE_OP_READ,
+                          PERF_COUNT_HW_CACHE_RESULT_MISS), 1}};
+
+    case PAPI_FP_OPS:
+        if (cpu == CPU_INTEL) {
+            // Umasks with the same number of operations per instruction are
+            // merged to save counters. The 5 events are opened as two groups
+            // ({0x03, 0x04, 0x18, 0x60} and {0x80}).
+            return {
+                {PERF_TYPE_RAW, INTEL_FP_ARITH(0x03), 1},  // Scalar SP and DP.
+                {PERF_TYPE_RAW, INTEL_FP_ARITH(0x04), 2},  // 128-bit DP.
+                {PERF_TYPE_RAW, INTEL_FP_ARITH(0x18), 4},  // 128-bit SP, 256-bit DP.
+                {PERF_TYPE_RAW, INTEL_FP_ARITH(0x60), 8},  // 256-bit SP, 512-bit DP.
+                {PERF_TYPE_RAW, INTEL_FP_ARITH(0x80), 16}, // 512-bit SP.
+            };
+        }
+        if (cpu == CPU_AMD) {
+            // RetiredSseAvxFlops, already counts operations. It can count more
+            // than 15 operations per cycle, so it needs the MergeEvent (0xfff)
+            // on the adjacent odd counter. The kernel pairs them since Linux
+            // 5.7, older kernels silently cap the count.
+            if (kernel_at_least(5, 7)) {
+                return {{PERF_TYPE_RAW, 0xff03, 1}};
+            }
+        }
+        if (cpu == CPU_A64FX) {
+            // FP_SCALE_OPS_SPEC counts per 128 bits, assume 512-bit SVE vectors.
+            return {
+                {PERF_TYPE_RAW, 0x80c0, 4}, // FP_SCALE_OPS_SPEC.
+                {PERF_TYPE_RAW, 0x80c1, 1}, // FP_FIXED_OPS_SPEC.
+            };
+        }
+        return {};
+
+    case PAPI_SP_OPS:
+        if (cpu == CPU_INTEL) {
+            return {
+                {PERF_TYPE_RAW, INTEL_FP_ARITH(0x02), 1},  // Scalar.
+                {PERF_TYPE_RAW, INTEL_FP_ARITH(0x08), 4},  // 128-bit.
+                {PERF_TYPE_RAW, INTEL_FP_ARITH(0x20), 8},  // 256-bit.
+                {PERF_TYPE_RAW, INTEL_FP_ARITH(0x80), 16}, // 512-bit.
+            };
+        }
+        return {};
+
+    case PAPI_DP_OPS:
+        if (cpu == CPU_INTEL) {
+            return {
+                {PERF_TYPE_RAW, INTEL_FP_ARITH(0x01), 1}, // Scalar.
+                {PERF_TYPE_RAW, INTEL_FP_ARITH(0x04), 2}, // 128-bit.
+                {PERF_TYPE_RAW, INTEL_FP_ARITH(0x10), 4}, // 256-bit.
+                {PERF_TYPE_RAW, INTEL_FP_ARITH(0x40), 8}, // 512-bit.
+            };
+        }
+        return {};
+
+    default:
+        return {};
+    }
+}
+
+std::vector<std::vector<PresetStopwatch::Native>>
+PresetStopwatch::split_groups(const std::vector<Native> &preset_natives) {
+    std::vector<std::vector<Native>> groups;
+
+    for (size_t i = 0; i < preset_natives.size(); i += MAX_GROUP_SIZE) {
+        const size_t end = std::min(i + MAX_GROUP_SIZE, preset_natives.size());
+
+        groups.emplace_back(preset_natives.begin() + i, preset_natives.begin() + end);
+    }
+
+    return groups;
+}
+
+bool PresetStopwatch::open_group(const std::vector<Native> &group, std::vector<int> &fds) {
+    fds.clear();
+
+    for (size_t i = 0; i < group.size(); ++i) {
+        struct perf_event_attr pe;
+
+        memset(&pe, 0, sizeof(struct perf_event_attr));
+        pe.size = sizeof(struct perf_event_attr);
+        pe.disabled = i == 0; // Only the leader.
+
+        // Exclude kernel and hypervisor from being measured.
+        pe.exclude_kernel = 1;
+        pe.exclude_hv = 1;
+
+        // Children inherit it
+        pe.inherit = 1;
+
+        // Read every member of the group at once, with the time the group has
+        // been enabled and running on the PMU.
+        pe.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                         PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        // Type of event to measure.
+        pe.type = group[i].type;
+        pe.config = group[i].config;
+
+        const int native_fd = syscall(__NR_perf_event_open, &pe, 0, -1, i == 0 ? -1 : fds[0], 0);
+
+        if (native_fd == -1) {
+            // A partial group would be counted wrong, drop it.
+            const int error = errno;
+
+            for (const auto &member_fd : fds) {
+                close(member_fd);
+            }
+            fds.clear();
+
+            errno = error;
+            return false;
+        }
+
+        fds.push_back(native_fd);
+    }
+
+    return true;
+}
@@ -0,0 +1,244 @@
+#pragma once
+
+#include <stdint.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+/**
+ * @author Lorién López Villellas (lorien.lopez@bsc.es)
+ *
+ * A module for counting portable preset events using perf.
+ * Presets are named after the PAPI presets (PAPI_TOT_CYC, PAPI_L1_DCM, ...).
+ * Each preset is mapped to the best native event(s) of the detected CPU, or
+ * derived from several native events (e.g. PAPI_FP_OPS on x86 is a weighted
+ * sum of the FP_ARITH_INST_RETIRED umasks).
+ *
+ * A PresetStopwatch works the same way a PerfStopwatch does, you can restart
+ * the stopwatch, start counting events by playing it, or stop counting events
+ * by pausing it.
+ *
+ * Unsupported presets are detected when the stopwatch is built, before any
+ * counter is started.
+ *
+ * The native events of a preset are opened as perf groups of at most
+ * MAX_GROUP_SIZE events, so they are counted over the same time, and a preset
+ * whose groups can not be scheduled on the PMU is reported as unsupported.
+ * If the kernel multiplexes the groups, the counts of every group are scaled
+ * by its own time enabled / time running.
+ *
+ * With -DHPCTOOLS_DISABLE_INSTRUMENTATION neither the CPU nor the presets are
+ * checked, no counter is opened and every preset reads 0.
+ *
+ * Warning: In order to tracks events for every thread, the main thread must
+ * be the one controlling the stopwatch.
+ */
+
+class PresetStopwatch {
+public:
+    enum Preset {
+        PAPI_TOT_CYC, // Total cycles.
+        PAPI_TOT_INS, // Instructions completed.
+        PAPI_REF_CYC, // Reference clock cycles.
+        PAPI_BR_INS,  // Branch instructions.
+        PAPI_BR_MSP,  // Conditional branch instructions mispredicted.
+        PAPI_L1_DCA,  // L1 data cache accesses.
+        PAPI_L1_DCM,  // L1 data cache misses.
+        PAPI_L1_ICM,  // L1 instruction cache misses.
+        PAPI_L2_DCM,  // L2 data cache misses.
+        PAPI_L3_TCM,  // L3 cache misses.
+        PAPI_TLB_DM,  // Data translation lookaside buffer misses.
+        PAPI_TLB_IM,  // Instruction translation lookaside buffer misses.
+        PAPI_FP_OPS,  // Floating point operations.
+        PAPI_SP_OPS,  // Single precision floating point operations.
+        PAPI_DP_OPS,  // Double precision floating point operations.
+
+        NUM_PRESETS
+    };
+
+    enum Cpu {
+        CPU_GENERIC,
+        CPU_INTEL,
+        CPU_AMD,
+        CPU_A64FX,
+        CPU_ARM,
+
+        NUM_CPUS
+    };
+
+    PresetStopwatch() = delete; // No default constructor allowed.
+
+    /**
+     * Initializes the stopwatch. Also performs a restart().
+     *
+     * If any of the requested presets is not supported by the current CPU, the
+     * constructor will throw an exception listing every unsupported preset
+     * without starting any counter.
+     *
+     * @param req_presets_ presets to track.
+     */
+    PresetStopwatch(const std::vector<Preset> &req_presets_);
+
+    PresetStopwatch(const PresetStopwatch &other) = delete;
+    PresetStopwatch &operator=(const PresetStopwatch &other) = delete;
+
+    /**
+     * Destroys the stopwatch.
+     *
+     */
+    ~PresetStopwatch();
+
+    /**
+     * Restarts the stopwatch counters.
+     *
+     */
+    void restart();
+
+    /**
+     * Start counting HW events.
+     *
+     */
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+    void play();
+#else
+    void play() {}
+#endif
+
+    /**
+     * Stop counting HW events.
+     *
+     */
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+    void pause();
+#else
+    void pause() {}
+#endif
+
+    /**
+     * Print the counter of every tracked preset into stdout.
+     *
+     */
+    void print_all_counters() const;
+
+    /**
+     * Get the counter of a preset.
+     *
+     * If the stopwatch is not tracking the target preset, the function
+     * will throw an exception.
+     *
+     * @param target_preset preset reference.
+     */
+    uint64_t get_counter(const Preset target_preset) const;
+
+    /**
+     * Get the name of a preset (e.g. "PAPI_TOT_CYC").
+     *
+     * @param target_preset preset reference.
+     * @return const char* (preset name).
+     */
+    static const char *get_name(const Preset target_preset);
+
+    /**
+     * Get the description of a preset.
+     *
+     * @param target_preset preset reference.
+     * @return const char* (preset descriptor).
+     */
+    static const char *get_descriptor(const Preset target_preset);
+
+    /**
+     * Detect the CPU of the node.
+     *
+     * @return Cpu detected CPU.
+     */
+    static Cpu detect_cpu();
+
+    /**
+     * Get the presets that can not be counted in the current CPU, either because
+     * there is no mapping for the CPU or because the kernel refuses to open the
+     * groups of native events of the mapping (e.g. a group needs more counters
+     * than the PMU has).
+     *
+     * @param presets presets to check.
+     * @return std::vector<Preset> unsupported presets.
+     */
+    static std::vector<Preset> get_unsupported(const std::vector<Preset> &presets);
+
+private:
+    // A native event and its weight in the derived preset.
+    struct Native {
+        uint32_t type;
+        uint64_t config;
+        int64_t weight;
+    };
+
+    // Preset names.
+    static const char *names[NUM_PRESETS];
+
+    // Preset description.
+    static const char *descriptors[NUM_PRESETS];
+
+    // CPU names.
+    static const char *cpu_names[NUM_CPUS];
+
+    std::vector<Preset> req_presets; // Presets being tracked.
+
+    // Max. native events of a group. Intel CPUs have 4 general-purpose
+    // counters per hardware thread with Hyper-Threading on.
+    static const size_t MAX_GROUP_SIZE = 4;
+
+    std::vector<size_t> first_native; // Index of the first native of each preset.
+    std::vector<Native> natives;      // Native events of every preset.
+    std::vector<int> fd;              // File descriptor of each native event.
+
+    std::vector<size_t> first_member; // Index of the first native (leader) of each group.
+    std::vector<size_t> group_preset; // Index in req_presets of the preset of each group.
+
+    std::vector<uint64_t> start_count; // Native counters on play time.
+    std::vector<double> total_count;   // Total (scaled) native count between plays and stops.
+
+    std::vector<uint64_t> start_enabled; // Time enabled of each group on play time.
+    std::vector<uint64_t> start_running; // Time running of each group on play time.
+
+    /**
+     * Get the native events of a preset for a CPU.
+     *
+     * @param preset preset reference.
+     * @param cpu CPU reference.
+     * @return std::vector<Native> native events, empty if the preset is not
+     *         available in the CPU.
+     */
+    static std::vector<Native> get_natives(const Preset preset, const Cpu cpu);
+
+    /**
+     * Split the native events of a preset into groups of at most
+     * MAX_GROUP_SIZE events.
+     *
+     * @param preset_natives native events of a preset.
+     * @return std::vector<std::vector<Native>> groups.
+     */
+    static std::vector<std::vector<Native>> split_groups(const std::vector<Native> &preset_natives);
+
+    /**
+     * Open native events as a group counting the calling process and its
+     * children. The group is disabled.
+     *
+     * @param group native events, the first one is the leader.
+     * @param fds Output file descriptors, one per native event.
+     * @return true if every native event has been opened, false otherwise
+     *         (nothing is left open).
+     */
+    static bool open_group(const std::vector<Native> &group, std::vector<int> &fds);
+
+    /**
+     * Read the counters of a group.
+     *
+     * @param group Index of the group in first_member.
+     * @param values Output counter of each native event of the group.
+     * @param enabled Output time enabled of the group.
+     * @param running Output time running of the group.
+     * @return true on success, false otherwise.
+     */
+    bool read_group(const size_t group, uint64_t *values, uint64_t &enabled,
+                    uint64_t &running) const;
+};
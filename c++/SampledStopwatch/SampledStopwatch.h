@@ -0,0 +1,423 @@
+#pragma once
+
+#include "../PerfStopwatch/PerfStopwatch.h"
+#include "../TimeStopwatch/TimeStopwatch.h"
+#include "../Tracer/Tracer.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @author Lorién López Villellas (lorien.lopez@bsc.es)
+ *
+ * A wrapper that only measures a subset of the play()/pause() calls of a
+ * stopwatch, for regions executed so many times that measuring all of them
+ * is too expensive:
+ *
+ *    SampledStopwatch<PerfStopwatch> stopwatch(PerfStopwatch({...}), 0.01);
+ *
+ * One of every N calls is measured, either periodically or at random (each
+ * call is measured with probability 1/N, using a xorshift generator). N is
+ * adjusted every ADJUST_SAMPLES samples so that the time spent in the
+ * measured play()/pause() calls stays under a fraction of the time spent in
+ * the region (target_overhead).
+ *
+ * Totals are estimated by weighting every sample by the N it was taken with
+ * (Horvitz-Thompson estimator), the report shows the estimates with their
+ * 95% confidence interval. The interval assumes random sampling, with
+ * periodic sampling it is an approximation.
+ *
+ * The values of a stopwatch are defined by SampledStopwatchTraits, provided
+ * for TimeStopwatch and PerfStopwatch.
+ *
+ * Building with -DHPCTOOLS_DISABLE_INSTRUMENTATION turns play() and pause()
+ * into no-ops, nothing is sampled.
+ *
+ * Warning: A measured call is slightly slower than an unmeasured one (the
+ * measurement disturbs caches and branch predictors), so regions that last
+ * less than a few microseconds are overestimated.
+ */
+
+/**
+ * Values of a stopwatch. A specialization must provide:
+ *
+ *    explicit SampledStopwatchTraits(const Stopwatch &stopwatch);
+ *    const std::vector<std::string> &get_names() const;
+ *    void read(const Stopwatch &stopwatch, double *values);
+ *
+ * It is built once per SampledStopwatch, so read(), called twice per sample,
+ * can reuse what the constructor caches.
+ */
+template <class Stopwatch>
+struct SampledStopwatchTraits;
+
+template <>
+struct SampledStopwatchTraits<TimeStopwatch> {
+    explicit SampledStopwatchTraits(const TimeStopwatch &) : names({"seconds"}) {}
+
+    const std::vector<std::string> &get_names() const {
+        return names;
+    }
+
+    void read(const TimeStopwatch &stopwatch, double *values) {
+        values[0] = stopwatch.get_s();
+    }
+
+private:
+    std::vector<std::string> names;
+};
+
+template <>
+struct SampledStopwatchTraits<PerfStopwatch> {
+    explicit SampledStopwatchTraits(const PerfStopwatch &stopwatch) {
+        for (const auto &event : stopwatch.get_events()) {
+            names.push_back(PerfStopwatch::get_descriptor(event));
+        }
+
+        counters.resize(names.size());
+    }
+
+    const std::vector<std::string> &get_names() const {
+        return names;
+    }
+
+    void read(const PerfStopwatch &stopwatch, double *values) {
+        stopwatch.get_counters(counters.data());
+
+        for (size_t i = 0; i < counters.size(); ++i) {
+            values[i] = counters[i];
+        }
+    }
+
+private:
+    std::vector<std::string> names;
+    std::vector<uint64_t> counters; // Reused by every read().
+};
+
+template <class Stopwatch, class Traits = SampledStopwatchTraits<Stopwatch>>
+class SampledStopwatch {
+public:
+    enum Mode {
+        PERIODIC,
+        RANDOM,
+    };
+
+    // Samples between adjustments of N.
+    static const uint64_t ADJUST_SAMPLES = 64;
+
+    // Max. N.
+    static const uint64_t MAX_PERIOD = 1 << 20;
+
+    /**
+     * Wrap a stopwatch. Also performs a restart().
+     *
+     * @param stopwatch_ Stopwatch to sample.
+     * @param target_overhead_ Max. fraction of the time of the region spent
+     *                         measuring it.
+     * @param mode_ Sampling mode.
+     * @param seed Seed of the random generator.
+     */
+    SampledStopwatch(Stopwatch stopwatch_, const double target_overhead_ = 0.01,
+                     const Mode mode_ = RANDOM, const uint64_t seed = 0x9E3779B97F4A7C15UL) :
+        stopwatch(std::move(stopwatch_)),
+        traits(stopwatch),
+        names(traits.get_names()),
+        target_overhead(target_overhead_),
+        mode(mode_),
+        rng_state(seed == 0 ? 1 : seed),
+        before(names.size()),
+        after(names.size()),
+        estimate(names.size()),
+        variance(names.size()) {
+
+        restart();
+    }
+
+    /**
+     * Restarts the counters and the period.
+     *
+     */
+    void restart() {
+        stopwatch.restart();
+
+        for (size_t i = 0; i < names.size(); ++i) {
+            estimate[i] = 0;
+            variance[i] = 0;
+        }
+
+        calls = 0;
+        samples = 0;
+        sampling = false;
+        min_period = MAX_PERIOD;
+        max_period = 1;
+
+        window_overhead = 0;
+        window_body = 0;
+        window_samples = 0;
+        overhead_ticks = 0;
+        body_ticks = 0;
+
+        set_period(1);
+    }
+
+    /**
+     * Start measuring, if this call is sampled.
+     *
+     */
+    inline void play() {
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+        ++calls;
+
+        if (mode == PERIODIC) {
+            sampling = --countdown == 0;
+            if (sampling) {
+                countdown = period;
+            }
+        }
+        else {
+            sampling = period == 1 || next_random() < threshold;
+        }
+
+        if (sampling) {
+            play_ticks = Tracer::get_ticks();
+            traits.read(stopwatch, before.data());
+            stopwatch.play();
+            body_start_ticks = Tracer::get_ticks();
+        }
+#endif
+    }
+
+    /**
+     * Stop measuring, if this call is sampled.
+     *
+     */
+    inline void pause() {
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+        if (sampling) {
+            const uint64_t body_stop_ticks = Tracer::get_ticks();
+            stopwatch.pause();
+            traits.read(stopwatch, after.data());
+
+            record_sample(body_stop_ticks);
+
+            sampling = false;
+        }
+#endif
+    }
+
+    /**
+     * Print the estimate of every value into stdout.
+     *
+     */
+    void print_all_counters() const {
+        const bool exact = max_period == 1;
+
+        if (exact) {
+            printf("%16s: %lu calls, all measured (exact)\n", "sampling", calls);
+        }
+        else {
+            printf("%16s: %lu of %lu calls measured, 1/%lu - 1/%lu (%s), %.2lf%% overhead\n",
+                   "SAMPLED", samples, calls, min_period, max_period,
+                   mode == PERIODIC ? "periodic" : "random", 100 * get_overhead());
+        }
+
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (exact) {
+                printf("%16s: %14.6lf\n", names[i].c_str(), estimate[i]);
+            }
+            else {
+                printf("%16s: %14.6lf +- %.6lf (95%% CI, estimate)\n", names[i].c_str(),
+                       estimate[i], get_error(i));
+            }
+        }
+    }
+
+    /**
+     * Get the names of the values.
+     *
+     */
+    const std::vector<std::string> &get_names() const {
+        return names;
+    }
+
+    /**
+     * Get the estimated total of a value.
+     *
+     * @param value Value index (see get_names()).
+     */
+    double get_estimate(const size_t value) const {
+        return estimate[value];
+    }
+
+    /**
+     * Get the half-width of the 95% confidence interval of the estimated
+     * total of a value (0 if every call has been measured).
+     *
+     * @param value Value index (see get_names()).
+     */
+    double get_error(const size_t value) const {
+        return 1.96 * sqrt(variance[value]);
+    }
+
+    /**
+     * Check if the totals are estimates (some call has not been measured).
+     *
+     */
+    bool is_estimate() const {
+        return max_period > 1;
+    }
+
+    /**
+     * Get the number of play() calls.
+     *
+     */
+    uint64_t get_calls() const {
+        return calls;
+    }
+
+    /**
+     * Get the number of measured calls.
+     *
+     */
+    uint64_t get_samples() const {
+        return samples;
+    }
+
+    /**
+     * Get the current period (one of every N calls is measured).
+     *
+     */
+    uint64_t get_period() const {
+        return period;
+    }
+
+    /**
+     * Get the estimated fraction of the time of the region spent measuring
+     * it.
+     *
+     */
+    double get_overhead() const {
+        // Unmeasured calls are estimated with the mean of the measured ones.
+        const double total_body = samples == 0 ? 0 : (double)body_ticks / samples * calls;
+
+        return total_body == 0 ? 0 : overhead_ticks / total_body;
+    }
+
+    /**
+     * Get the wrapped stopwatch. Its counters only hold the measured calls.
+     *
+     */
+    const Stopwatch &get_stopwatch() const {
+        return stopwatch;
+    }
+
+private:
+    Stopwatch stopwatch;
+    Traits traits;
+    std::vector<std::string> names;
+
+    double target_overhead;
+    Mode mode;
+
+    uint64_t period;    // N.
+    uint64_t countdown; // Calls until the next sample (PERIODIC).
+    uint64_t threshold; // A call is sampled if the next random number is below (RANDOM).
+    uint64_t rng_state;
+
+    uint64_t min_period; // Periods used.
+    uint64_t max_period;
+
+    uint64_t calls;
+    uint64_t samples;
+    bool sampling; // The current call is being measured.
+
+    std::vector<double> before; // Values before the sampled play().
+    std::vector<double> after;  // Values after the sampled pause().
+
+    std::vector<double> estimate; // Estimated totals.
+    std::vector<double> variance; // Variance of the estimated totals.
+
+    uint64_t play_ticks;       // Start of the sampled play().
+    uint64_t body_start_ticks; // End of the sampled play().
+
+    uint64_t window_overhead; // Ticks spent in play()/pause() since the last adjustment.
+    uint64_t window_body;     // Ticks spent in the region since the last adjustment.
+    uint64_t window_samples;
+
+    uint64_t overhead_ticks; // Estimated ticks spent in play()/pause().
+    uint64_t body_ticks;     // Ticks spent in the measured calls.
+
+    /**
+     * xorshift64 generator.
+     *
+     */
+    inline uint64_t next_random() {
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 7;
+        rng_state ^= rng_state << 17;
+
+        return rng_state;
+    }
+
+    /**
+     * Set N.
+     *
+     */
+    void set_period(const uint64_t period_) {
+        period = period_;
+        countdown = period;
+        threshold = UINT64_MAX / period;
+
+        min_period = period < min_period ? period : min_period;
+        max_period = period > max_period ? period : max_period;
+    }
+
+    /**
+     * Add a sample to the estimates and adjust N.
+     *
+     */
+    void record_sample(const uint64_t body_stop_ticks) {
+        // Every sample stands for N calls.
+        const double weight = period;
+
+        for (size_t i = 0; i < names.size(); ++i) {
+            const double value = after[i] - before[i];
+
+            estimate[i] += weight * value;
+            variance[i] += weight * (weight - 1) * value * value;
+        }
+
+        const uint64_t overhead = (body_start_ticks - play_ticks) +
+                                  (Tracer::get_ticks() - body_stop_ticks);
+
+        ++samples;
+        overhead_ticks += overhead;
+        body_ticks += body_stop_ticks - body_start_ticks;
+
+        window_overhead += overhead;
+        window_body += body_stop_ticks - body_start_ticks;
+        ++window_samples;
+
+        if (window_samples == ADJUST_SAMPLES) {
+            // overhead / (N * body) <= target_overhead.
+            const double mean_overhead = (double)window_overhead / window_samples;
+            const double mean_body = (double)window_body / window_samples;
+
+            double new_period = mean_body == 0 ? MAX_PERIOD
+                                                : ceil(mean_overhead / (target_overhead * mean_body));
+
+            new_period = new_period < 1 ? 1 : new_period > MAX_PERIOD ? MAX_PERIOD : new_period;
+
+            set_period(new_period);
+
+            window_overhead = 0;
+            window_body = 0;
+            window_samples = 0;
+        }
+    }
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdio.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+ * @author Lorién López Villellas (lorien.lopez@bsc.es)
+ *
+ * Helpers for reading the sysfs and procfs files that describe the node
+ * (PMUs, NUMA nodes, powercap zones...), shared by the modules that read
+ * them.
+ */
+
+/**
+ * Read the first line of a file.
+ *
+ * @return The line, empty if the file cannot be read.
+ */
+inline std::string read_line(const std::string &path) {
+    std::ifstream file(path);
+    std::string line;
+
+    std::getline(file, line);
+
+    return line;
+}
+
+/**
+ * Parse a list of CPUs or nodes ("0-3,8,10-11").
+ *
+ */
+inline std::vector<int> parse_list(const std::string &list) {
+    std::vector<int> ids;
+    std::stringstream ranges(list);
+    std::string range;
+
+    while (std::getline(ranges, range, ',')) {
+        int lo = 0;
+        int hi = 0;
+
+        const int n = sscanf(range.c_str(), "%d-%d", &lo, &hi);
+        if (n < 1) {
+            continue;
+        }
+        if (n == 1) {
+            hi = lo;
+        }
+
+        for (int id = lo; id <= hi; ++id) {
+            ids.push_back(id);
+        }
+    }
+
+    return ids;
+}
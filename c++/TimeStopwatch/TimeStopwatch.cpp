@@ -3,13 +3,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-TimeStopwatch::TimeStopwatch() : total_secs(0) {}
+TimeStopwatch::TimeStopwatch() : total_secs(0), trace_region(Tracer::NO_REGION),
+                                 metric_slot(MetricRegistry::NO_SLOT) {}
 
 void TimeStopwatch::restart() {
     total_secs = 0;
 }
 
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
 void TimeStopwatch::play() {
+    Tracer::enter(trace_region);
     gettimeofday(&start, NULL);
 }
 
@@ -18,7 +21,12 @@ void TimeStopwatch::pause() {
     gettimeofday(&stop, NULL);
     total_secs += (stop.tv_sec - start.tv_sec)
                   + (stop.tv_usec - start.tv_usec) / 1000000.0;
+    Tracer::exit(trace_region);
+
+    const uint64_t total_ns = total_secs * 1e9;
+    MetricRegistry::publish(metric_slot, &total_ns, 1);
 }
+#endif
 
 void TimeStopwatch::print_s() const {
     printf("%lf", total_secs);
@@ -26,4 +34,12 @@ void TimeStopwatch::print_s() const {
 
 double TimeStopwatch::get_s() const {
     return total_secs;
+}
+
+void TimeStopwatch::trace(const std::string &region_name) {
+    trace_region = Tracer::register_region(region_name);
+}
+
+void TimeStopwatch::publish(const std::string &region_name) {
+    metric_slot = MetricRegistry::register_metric(region_name, {"time ns"});
 }
\ No newline at end of file
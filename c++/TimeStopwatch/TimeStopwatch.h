@@ -1,12 +1,20 @@
 #pragma once
 
+#include "../MetricRegistry/MetricRegistry.h"
+#include "../Tracer/Tracer.h"
+
+#include <stdint.h>
 #include <sys/time.h>
+#include <string>
 
 /**
  * @author Lorién López Villellas (lorien.lopez@bsc.es)
  *
  * A module for counting time the same way a stopwatch does. You can restart,
  * play or stop a stopwatch.
+ *
+ * With -DHPCTOOLS_DISABLE_INSTRUMENTATION play() and pause() do nothing and
+ * the counted time is 0.
  */
 
 class TimeStopwatch {
@@ -27,13 +35,21 @@ public:
      * Start counting time.
      *
      */
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
     void play();
+#else
+    void play() {}
+#endif
 
     /**
      * Stop counting time and add the current counted time to the total counted time.
      *
      */
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
     void pause();
+#else
+    void pause() {}
+#endif
 
     /**
      * Print to stdout the total counted time in seconds.
@@ -47,7 +63,25 @@ public:
      */
     double get_s() const;
 
+    /**
+     * Record every play() and pause() in the trace of Tracer as an enter and
+     * an exit of a region.
+     *
+     * @param region_name Name of the region.
+     */
+    void trace(const std::string &region_name);
+
+    /**
+     * Publish the total time ("time ns") into MetricRegistry on every
+     * pause(), so it can be monitored with hpcmon.
+     *
+     * @param region_name Name of the region.
+     */
+    void publish(const std::string &region_name);
+
 private:
     timeval start; // Last play timestamp.
     double total_secs;    // Total seconds counted.
+    uint32_t trace_region; // Tracer region, Tracer::NO_REGION if not traced.
+    uint32_t metric_slot;  // MetricRegistry slot, MetricRegistry::NO_SLOT if not published.
 };
\ No newline at end of file
@@ -0,0 +1,287 @@
+#define _GNU_SOURCE 1
+
+#include "Tracer.h"
+
+#include "printer.h"
+
+#include <asm/unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+std::atomic<bool> Tracer::enabled(false);
+std::atomic<uint64_t> Tracer::generation(0);
+
+thread_local Tracer::ThreadBuffer *Tracer::thread_buffer = nullptr;
+thread_local uint64_t Tracer::thread_generation = 0;
+
+std::vector<std::unique_ptr<Tracer::ThreadBuffer>> Tracer::buffers;
+
+size_t Tracer::chunk_records = 0;
+size_t Tracer::chunks_per_thread = 0;
+
+// A registered region.
+struct Region {
+    std::string name;
+    std::vector<std::string> counter_names;
+};
+
+// Protects the buffers and everything below.
+static std::mutex mutex;
+
+static std::vector<Region> regions;
+
+static FILE *file = nullptr;
+static Tracer::Header header;
+
+static uint64_t start_ns;
+
+static std::thread writer_thread;
+static std::condition_variable writer_cv;
+static bool writer_running = false;
+
+// stop() is registered with atexit(), so writer_thread is joined before it
+// is destroyed (a joinable std::thread calls std::terminate).
+static bool stop_registered = false;
+
+/**
+ * Get the current time in nanoseconds.
+ *
+ */
+static uint64_t get_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+void Tracer::start(const std::string &path, const size_t chunk_records_,
+                   const size_t chunks_per_thread_) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (file != nullptr) {
+        print_error("Tracer: Already tracing\n");
+        return;
+    }
+
+    file = fopen(path.c_str(), "wb");
+
+    if (file == nullptr) {
+        print_error("Tracer: Error opening %s %s\n", path.c_str(), strerror(errno));
+        return;
+    }
+
+    chunk_records = chunk_records_;
+    chunks_per_thread = chunks_per_thread_;
+
+    // Buffers of previous sessions are no longer used.
+    buffers.clear();
+    generation.fetch_add(1);
+
+    memset(&header, 0, sizeof(Header));
+    memcpy(header.magic, "HPCTRACE", sizeof(header.magic));
+    header.version = 1;
+    header.record_size = sizeof(Record);
+    header.pid = getpid();
+
+    // Placeholder, rewritten by stop().
+    fwrite(&header, sizeof(Header), 1, file);
+
+    start_ns = get_ns();
+    header.start_ticks = get_ticks();
+
+    writer_running = true;
+    writer_thread = std::thread(writer);
+
+    // Exit handlers run before the destructors of the statics constructed
+    // earlier, such as writer_thread.
+    if (!stop_registered) {
+        atexit(stop);
+        stop_registered = true;
+    }
+
+    enabled.store(true);
+}
+
+void Tracer::stop() {
+    enabled.store(false);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (file == nullptr) {
+            return;
+        }
+
+        writer_running = false;
+    }
+
+    writer_cv.notify_one();
+    writer_thread.join();
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    write_chunks(true);
+
+    const uint64_t ticks = get_ticks() - header.start_ticks;
+    const uint64_t ns = get_ns() - start_ns;
+
+    header.ticks_per_sec = ns == 0 ? 1e9 : ticks * 1e9 / ns;
+    header.regions_offset = ftell(file);
+    header.num_regions = regions.size();
+
+    for (const auto &buffer : buffers) {
+        header.dropped += buffer->dropped.load();
+    }
+
+    // Region table.
+    for (const auto &region : regions) {
+        const uint32_t name_len = region.name.size();
+        fwrite(&name_len, sizeof(uint32_t), 1, file);
+        fwrite(region.name.data(), 1, name_len, file);
+
+        const uint32_t num_counters = region.counter_names.size();
+        fwrite(&num_counters, sizeof(uint32_t), 1, file);
+
+        for (const auto &counter_name : region.counter_names) {
+            const uint32_t counter_len = counter_name.size();
+            fwrite(&counter_len, sizeof(uint32_t), 1, file);
+            fwrite(counter_name.data(), 1, counter_len, file);
+        }
+    }
+
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(Header), 1, file);
+
+    fclose(file);
+    file = nullptr;
+
+    if (header.dropped != 0) {
+        print_error("Tracer: %lu records have been dropped\n", header.dropped);
+    }
+}
+
+uint32_t Tracer::register_region(const std::string &name,
+                                 const std::vector<std::string> &counter_names) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    regions.push_back({name, counter_names});
+
+    return regions.size() - 1;
+}
+
+uint64_t Tracer::get_dropped() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint64_t dropped = 0;
+    for (const auto &buffer : buffers) {
+        dropped += buffer->dropped.load();
+    }
+
+    return dropped;
+}
+
+bool Tracer::next_chunk(ThreadBuffer *buffer) {
+    const size_t next = (buffer->current + 1) % chunks_per_thread;
+    Chunk &chunk = buffer->chunks[next];
+
+    if (chunk.state.load(std::memory_order_acquire) != FREE) {
+        return false;
+    }
+
+    chunk.count = 0;
+    buffer->current = next;
+    buffer->full = false;
+
+    return true;
+}
+
+Tracer::ThreadBuffer *Tracer::register_thread() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer());
+
+    buffer->tid = syscall(__NR_gettid);
+    buffer->chunks = std::vector<Chunk>(chunks_per_thread);
+    buffer->storage.resize(chunk_records * chunks_per_thread);
+    buffer->current = 0;
+    buffer->full = false;
+    buffer->dropped.store(0);
+
+    for (size_t i = 0; i < chunks_per_thread; ++i) {
+        buffer->chunks[i].state.store(FREE);
+        buffer->chunks[i].count = 0;
+        buffer->chunks[i].records = &buffer->storage[i * chunk_records];
+    }
+
+    thread_buffer = buffer.get();
+    thread_generation = generation.load();
+    buffers.push_back(std::move(buffer));
+
+    return thread_buffer;
+}
+
+void Tracer::writer() {
+    std::vector<Chunk *> full_chunks;
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (writer_running) {
+        // Collect the full chunks under the lock and write them without it,
+        // so register_thread() and register_region() do not wait for the
+        // disk. Buffers are only freed by start(), while the writer is not
+        // running.
+        full_chunks.clear();
+
+        for (const auto &buffer : buffers) {
+            for (auto &chunk : buffer->chunks) {
+                if (chunk.state.load(std::memory_order_acquire) == FULL) {
+                    full_chunks.push_back(&chunk);
+                }
+            }
+        }
+
+        lock.unlock();
+
+        // trace2chrome sorts the records, the order of the chunks does not matter.
+        for (const auto &chunk : full_chunks) {
+            fwrite(chunk->records, sizeof(Record), chunk->count, file);
+            chunk->state.store(FREE, std::memory_order_release);
+        }
+
+        fflush(file);
+
+        lock.lock();
+
+        if (writer_running) {
+            writer_cv.wait_for(lock, std::chrono::milliseconds(10));
+        }
+    }
+}
+
+void Tracer::write_chunks(const bool partial) {
+    for (const auto &buffer : buffers) {
+        // trace2chrome sorts the records, the order of the chunks does not matter.
+        for (auto &chunk : buffer->chunks) {
+            if (chunk.state.load(std::memory_order_acquire) == FULL) {
+                fwrite(chunk.records, sizeof(Record), chunk.count, file);
+                chunk.state.store(FREE, std::memory_order_release);
+            }
+        }
+
+        if (partial && !buffer->full) {
+            Chunk &chunk = buffer->chunks[buffer->current];
+
+            fwrite(chunk.records, sizeof(Record), chunk.count, file);
+            chunk.count = 0;
+        }
+    }
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+/**
+ * @author Lorién López Villellas (lorien.lopez@bsc.es)
+ *
+ * A module for tracing when the regions of a program are entered and exited.
+ *
+ * Every enter()/exit() appends a fixed-size binary record (timestamp, region,
+ * thread and optional counter deltas) to a preallocated buffer of the calling
+ * thread. Each buffer is a ring of chunks: the thread fills a chunk without
+ * locks or syscalls and hands it to a background thread that writes it to
+ * the trace file. If the background thread falls behind, records are dropped
+ * (and counted) instead of blocking the traced thread.
+ *
+ * TimeStopwatch and PerfStopwatch emit a record on every play()/pause()
+ * after calling their trace() method.
+ *
+ * Use trace2chrome to convert a trace into the Chrome trace JSON format, which
+ * can be opened with chrome://tracing or Perfetto.
+ *
+ * Building with -DHPCTOOLS_DISABLE_INSTRUMENTATION turns enter() and exit()
+ * into no-ops.
+ *
+ * If the program exits without calling stop(), the trace is stopped (and
+ * completed) at exit.
+ *
+ * Warning: stop() must be called when no thread is tracing.
+ */
+
+class Tracer {
+public:
+    // Max. counter deltas of a record.
+    static const int MAX_COUNTERS = 2;
+
+    // Region ID of the untraced regions.
+    static const uint32_t NO_REGION = UINT32_MAX;
+
+    enum Kind : uint16_t {
+        ENTER,
+        EXIT,
+    };
+
+    // A trace record.
+    struct Record {
+        uint64_t timestamp;
+        uint32_t region;
+        uint32_t tid;
+        uint16_t kind;
+        uint16_t num_counters;
+        uint32_t reserved;
+        uint64_t counters[MAX_COUNTERS];
+    };
+
+    // Header of a trace file. The records follow the header, the region table
+    // (name and counter names of every region) is at the end of the file.
+    struct Header {
+        char magic[8]; // "HPCTRACE"
+        uint32_t version;
+        uint32_t record_size;
+        double ticks_per_sec;
+        uint64_t start_ticks;
+        uint64_t regions_offset;
+        uint32_t num_regions;
+        uint32_t pid;
+        uint64_t dropped;
+    };
+
+    Tracer() = delete; // Static class.
+
+    /**
+     * Start tracing into a file.
+     *
+     * @param path Path of the trace file.
+     * @param chunk_records Records of each chunk.
+     * @param chunks_per_thread Chunks of the buffer of each thread.
+     */
+    static void start(const std::string &path, const size_t chunk_records = 4096,
+                      const size_t chunks_per_thread = 8);
+
+    /**
+     * Stop tracing, write the remaining records and close the trace file.
+     * Called at exit if tracing has not been stopped.
+     *
+     */
+    static void stop();
+
+    /**
+     * Register a region.
+     *
+     * @param name Name of the region.
+     * @param counter_names Names of the counters of the records of the region.
+     * @return uint32_t region ID.
+     */
+    static uint32_t register_region(const std::string &name,
+                                    const std::vector<std::string> &counter_names = {});
+
+    /**
+     * Record that the calling thread enters a region.
+     *
+     * @param region Region ID.
+     */
+    static inline void enter(const uint32_t region) {
+        record(ENTER, region, nullptr, 0);
+    }
+
+    /**
+     * Record that the calling thread exits a region.
+     *
+     * @param region Region ID.
+     * @param counters Counter deltas of the region (optional).
+     * @param num_counters Number of counters (up to MAX_COUNTERS).
+     */
+    static inline void exit(const uint32_t region, const uint64_t *counters = nullptr,
+                            const int num_counters = 0) {
+        record(EXIT, region, counters, num_counters);
+    }
+
+    /**
+     * Get the number of records dropped because a buffer was full.
+     *
+     */
+    static uint64_t get_dropped();
+
+    /**
+     * Get the current timestamp (TSC on x86, virtual counter on aarch64,
+     * nanoseconds otherwise).
+     *
+     */
+    static inline uint64_t get_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#elif defined(__aarch64__)
+        uint64_t ticks;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+        return ticks;
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+#endif
+    }
+
+private:
+    enum ChunkState : int {
+        FREE,
+        FULL,
+    };
+
+    // A chunk of records.
+    struct Chunk {
+        std::atomic<int> state;
+        size_t count;
+        Record *records;
+    };
+
+    // The buffer of a thread.
+    struct ThreadBuffer {
+        uint32_t tid;
+        std::vector<Chunk> chunks;
+        size_t current; // Chunk being filled.
+        bool full;      // The current chunk has been handed to the writer thread.
+        std::atomic<uint64_t> dropped;
+        std::vector<Record> storage;
+    };
+
+    static std::atomic<bool> enabled;
+    static std::atomic<uint64_t> generation;
+
+    // Buffer of the calling thread, only valid if thread_generation is the
+    // current generation (start() frees the buffers of previous sessions).
+    static thread_local ThreadBuffer *thread_buffer;
+    static thread_local uint64_t thread_generation;
+
+    static std::vector<std::unique_ptr<ThreadBuffer>> buffers; // Buffers of every thread.
+
+    static size_t chunk_records;
+    static size_t chunks_per_thread;
+
+    /**
+     * Append a record to the buffer of the calling thread.
+     *
+     */
+    static inline void record(const Kind kind, const uint32_t region,
+                              const uint64_t *counters, const int num_counters) {
+#ifndef HPCTOOLS_DISABLE_INSTRUMENTATION
+        if (!enabled.load(std::memory_order_relaxed) || region == NO_REGION) {
+            return;
+        }
+
+        ThreadBuffer *buffer = thread_buffer;
+
+        if (buffer == nullptr ||
+            thread_generation != generation.load(std::memory_order_relaxed)) {
+            buffer = register_thread();
+        }
+
+        if (buffer->full && !next_chunk(buffer)) {
+            buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        Chunk &chunk = buffer->chunks[buffer->current];
+        Record &rec = chunk.records[chunk.count++];
+
+        rec.timestamp = get_ticks();
+        rec.region = region;
+        rec.tid = buffer->tid;
+        rec.kind = kind;
+        rec.num_counters = num_counters < MAX_COUNTERS ? num_counters : MAX_COUNTERS;
+        for (int i = 0; i < rec.num_counters; ++i) {
+            rec.counters[i] = counters[i];
+        }
+
+        if (chunk.count == chunk_records) {
+            // Hand the chunk to the writer thread.
+            chunk.state.store(FULL, std::memory_order_release);
+            buffer->full = true;
+            next_chunk(buffer);
+        }
+#else
+        (void)kind;
+        (void)region;
+        (void)counters;
+        (void)num_counters;
+#endif
+    }
+
+    /**
+     * Move to the next chunk of a buffer if it has been written.
+     *
+     * @return true if the buffer has a chunk to fill, false otherwise.
+     */
+    static bool next_chunk(ThreadBuffer *buffer);
+
+    /**
+     * Allocate the buffer of the calling thread.
+     *
+     */
+    static ThreadBuffer *register_thread();
+
+    /**
+     * Body of the writer thread.
+     *
+     */
+    static void writer();
+
+    /**
+     * Write the full chunks of every buffer. If partial, also write the
+     * chunks being filled.
+     *
+     */
+    static void write_chunks(const bool partial);
+};
@@ -0,0 +1,191 @@
+/**
+ * @author Lorién López Villellas (lorien.lopez@bsc.es)
+ *
+ * Convert a trace written by Tracer into the Chrome trace JSON format, which
+ * can be opened with chrome://tracing or Perfetto (ui.perfetto.dev).
+ *
+ * Usage: trace2chrome trace.bin > trace.json
+ */
+
+#include "Tracer.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// A region of the trace.
+struct Region {
+    std::string name;
+    std::vector<std::string> counter_names;
+};
+
+/**
+ * Read a length-prefixed string.
+ *
+ */
+static bool read_string(FILE *file, std::string &str) {
+    uint32_t len;
+    if (fread(&len, sizeof(uint32_t), 1, file) != 1) {
+        return false;
+    }
+
+    str.resize(len);
+
+    return len == 0 || fread(&str[0], 1, len, file) == len;
+}
+
+/**
+ * Print a string as a JSON string.
+ *
+ */
+static void print_json_string(const std::string &str) {
+    putchar('"');
+
+    for (const auto &c : str) {
+        if (c == '"' || c == '\\') {
+            putchar('\\');
+            putchar(c);
+        }
+        else if ((unsigned char)c < 0x20) {
+            printf("\\u%04x", c);
+        }
+        else {
+            putchar(c);
+        }
+    }
+
+    putchar('"');
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s trace.bin > trace.json\n", argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "Error opening %s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+
+    Tracer::Header header;
+
+    if (fread(&header, sizeof(Tracer::Header), 1, file) != 1 ||
+        memcmp(header.magic, "HPCTRACE", sizeof(header.magic)) != 0) {
+        fprintf(stderr, "%s is not a trace\n", argv[1]);
+        return 1;
+    }
+
+    if (header.version != 1 || header.record_size != sizeof(Tracer::Record)) {
+        fprintf(stderr, "Unsupported trace version %u\n", header.version);
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0) {
+        fprintf(stderr, "Error reading %s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+
+    // stop() rewrites the header, a trace of a process that did not reach it
+    // has neither the region table nor the tick rate.
+    if (header.regions_offset < sizeof(Tracer::Header) ||
+        header.regions_offset > (uint64_t)st.st_size || header.ticks_per_sec == 0) {
+        fprintf(stderr, "%s is not complete, the traced process did not stop the Tracer\n",
+                argv[1]);
+        return 1;
+    }
+
+    // Records.
+    const size_t num_records =
+        (header.regions_offset - sizeof(Tracer::Header)) / sizeof(Tracer::Record);
+
+    std::vector<Tracer::Record> records(num_records);
+
+    if (fread(records.data(), sizeof(Tracer::Record), num_records, file) != num_records) {
+        fprintf(stderr, "Truncated trace\n");
+        return 1;
+    }
+
+    // Region table.
+    std::vector<Region> regions(header.num_regions);
+
+    for (auto &region : regions) {
+        uint32_t num_counters = 0;
+
+        if (!read_string(file, region.name) ||
+            fread(&num_counters, sizeof(uint32_t), 1, file) != 1) {
+            fprintf(stderr, "Truncated region table\n");
+            return 1;
+        }
+
+        region.counter_names.resize(num_counters);
+        for (auto &counter_name : region.counter_names) {
+            if (!read_string(file, counter_name)) {
+                fprintf(stderr, "Truncated region table\n");
+                return 1;
+            }
+        }
+    }
+
+    fclose(file);
+
+    // Chunks are written in any order.
+    std::stable_sort(records.begin(), records.end(),
+                     [](const Tracer::Record &a, const Tracer::Record &b) {
+                         return a.timestamp < b.timestamp;
+                     });
+
+    const double us_per_tick = 1e6 / header.ticks_per_sec;
+
+    printf("{\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":%lu},\"traceEvents\":[\n",
+           header.dropped);
+
+    bool first = true;
+    for (const auto &record : records) {
+        if (record.region >= regions.size()) {
+            continue;
+        }
+
+        const auto &region = regions[record.region];
+
+        printf("%s{\"name\":", first ? "" : ",\n");
+        print_json_string(region.name);
+        // Signed, a record can precede start_ticks if the TSCs of the cores
+        // are skewed.
+        const int64_t ticks = (int64_t)(record.timestamp - header.start_ticks);
+
+        printf(",\"ph\":\"%s\",\"ts\":%.3lf,\"pid\":%u,\"tid\":%u",
+               record.kind == Tracer::ENTER ? "B" : "E", ticks * us_per_tick, header.pid,
+               record.tid);
+
+        if (record.num_counters > 0) {
+            printf(",\"args\":{");
+
+            for (int i = 0; i < record.num_counters && i < Tracer::MAX_COUNTERS; ++i) {
+                const std::string name = i < (int)region.counter_names.size()
+                                             ? region.counter_names[i]
+                                             : "counter " + std::to_string(i);
+
+                printf("%s", i == 0 ? "" : ",");
+                print_json_string(name);
+                printf(":%lu", record.counters[i]);
+            }
+
+            printf("}");
+        }
+
+        printf("}");
+        first = false;
+    }
+
+    printf("\n]}\n");
+
+    return 0;
+}